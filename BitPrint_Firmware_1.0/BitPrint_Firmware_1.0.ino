@@ -4,22 +4,68 @@
 #include "GcodeParser.h"
 #include "FileManager.h"
 #include "Executor.h"
+#include "InterfaceControl.h"
+#include "MemoryMonitor.h"
+#include "SerialReceiver.h"
+#include "SerialHost.h"
 
-StepperController stepperX(stepPinX, dirPinX, enablePinX, limitSwitchX, stepsPerMMX, 0);
-StepperController stepperY(stepPinY, dirPinY, enablePinY, limitSwitchY, stepsPerMMY, 0);
-StepperController stepperZ(stepPinZ, dirPinZ, enablePinZ, limitSwitchZ, stepsPerMMZ, 0);
-StepperController stepperE(stepPinE, dirPinE, enablePinE, limitSwitchE, stepsPerMME, 0);
+StepperController stepperX(stepPinX, dirPinX, enablePinX, limitSwitchX, microstepPinsX, stepsPerMMX, 0);
+StepperController stepperY(stepPinY, dirPinY, enablePinY, limitSwitchY, microstepPinsY, stepsPerMMY, 0);
+StepperController stepperZ(stepPinZ, dirPinZ, enablePinZ, limitSwitchZ, microstepPinsZ, stepsPerMMZ, 0);
+StepperController stepperZ2(stepPinZ2, dirPinZ2, enablePinZ2, limitSwitchZ2, microstepPinsZ2, stepsPerMMZ, 0);
+StepperController stepperE(stepPinE, dirPinE, enablePinE, limitSwitchE, microstepPinsE, stepsPerMME, 0);
+StepperController stepperE1(stepPinE1, dirPinE1, enablePinE1, limitSwitchE1, microstepPinsE1, stepsPerMME1, 0);
 
-MotionPlanner motionPlanner(stepperX, stepperY, stepperZ, stepperE);
-GcodeParser parser(motionPlanner, stepperX, stepperY, stepperZ, stepperE);
-FileManager fileManager(chipSelect, &parser, &motionPlanner);
+// same order as motorAxis / motorTool in Config.h
+StepperController* motors[motorCount] = { &stepperX, &stepperY, &stepperZ, &stepperZ2, &stepperE, &stepperE1 };
+
+MotionPlanner motionPlanner(motors);
+SerialReceiver serialReceiver(motionPlanner);
+GcodeParser parser(motionPlanner);
+FileManager fileManager(chipSelect, &parser, &motionPlanner, &serialReceiver);
+SerialHost serialHost(serialReceiver, parser, fileManager, motionPlanner);
+InterfaceControl interfaceControl(motionPlanner);
+
+#ifdef __AVR__
+// Every buffer is allocated here or in the headers, the rest of the 8 KB is left for the stack,
+// the SD library (block cache, File handles) and the Arduino core (serial buffers)
+static_assert(sizeof(stepperX) * motorCount + sizeof(motors) + sizeof(motionPlanner) + sizeof(parser)
+                + sizeof(serialReceiver) + sizeof(fileManager) + sizeof(serialHost) + sizeof(interfaceControl)
+                + sizeof(cacheSectorBuffer) + sizeof(printLogBuffer)
+#if PROFILING_ENABLED
+                + sizeof(profiler)
+#endif
+                <= staticRamBudget,
+              "static RAM over budget, reduce plannerBufferSize, shaperQueueSize or the buffer sizes in Config.h");
+#endif
+
+#ifdef __AVR__
+ISR(TIMER1_COMPA_vect) {
+    uint16_t ticks = motionPlanner.stepTick() / 4 - 1;  // 4us per timer tick
+    // TCNT1 kept counting while stepTick ran, a compare value it has already passed would only
+    // match after the counter wrapped at 0xFFFF (262 ms), so the next call is never scheduled behind it
+    uint16_t earliest = TCNT1 + 2;
+    if (earliest > ticks) motionPlanner.countLateTick();
+    OCR1A = max(ticks, earliest);
+}
+#endif
+
+// The AVR core only keeps 64 received bytes, homing and the translation of a file take far longer
+// than those take to arrive, so they call this in between
+void receiveSerial() {
+    serialReceiver.poll();
+}
 
 void setup() {
-    Serial.begin(9600);
+    MemoryMonitor::paintStack();
+    Serial.begin(serialBaudRate);
+    motionPlanner.begin();
     fileManager.initializeSD();
     delay(1000);
     fileManager.listGcodeFiles();
-    fileManager.selectFile();
+    serialHost.begin();
 }
 
-void loop() {}
\ No newline at end of file
+void loop() {
+    serialHost.poll();
+}
\ No newline at end of file
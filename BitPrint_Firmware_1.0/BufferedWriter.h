@@ -0,0 +1,94 @@
+//This class collects output for an SD file in RAM and hands it to the card in whole 512 byte sectors.
+//Full sectors at sector aligned positions go straight to the card instead of being copied through the
+//SD library's single block cache one println at a time. In deferred mode (logging during a print)
+//writes never touch the card, the owner calls flushBuffer() when it is safe and data that does not fit is dropped.
+
+#ifndef BUFFEREDWRITER_H
+#define BUFFEREDWRITER_H
+
+#include <Arduino.h>
+#include <SD.h>
+#include "Config.h"
+
+class BufferedWriter : public Print {
+private:
+  File file;
+  uint8_t* buffer;
+  uint16_t capacity;
+  uint16_t count;
+  uint16_t limit;     // flush point, the first one ends on a sector boundary of the file
+  bool deferred;
+  uint32_t dropped;   // bytes lost in deferred mode
+
+  bool flushFull() {
+    if (deferred) return false;
+    return flushBuffer();
+  }
+
+public:
+  // size should be sdSectorSize for aligned writes, a smaller buffer works but writes partial sectors
+  BufferedWriter(uint8_t* buf, uint16_t size)
+    : buffer(buf), capacity(size), count(0), limit(size), deferred(false), dropped(0) {}
+
+  void begin(File& f, bool deferredFlush) {
+    file = f;
+    count = 0;
+    dropped = 0;
+    deferred = deferredFlush;
+    // fill up to the next sector boundary first so every later flush writes an aligned sector
+    uint16_t offset = file.position() % sdSectorSize;
+    limit = offset == 0 ? capacity : min((uint16_t)(sdSectorSize - offset), capacity);
+  }
+
+  size_t write(uint8_t c) override {
+    if (count >= limit && !flushFull()) {
+      dropped++;
+      return 0;
+    }
+    buffer[count++] = c;
+    return 1;
+  }
+
+  size_t write(const uint8_t* data, size_t size) override {
+    size_t written = 0;
+    while (written < size) {
+      if (count >= limit && !flushFull()) {
+        dropped += size - written;
+        break;
+      }
+      size_t chunk = min((size_t)(limit - count), size - written);
+      memcpy(buffer + count, data + written, chunk);
+      count += chunk;
+      written += chunk;
+    }
+    return written;
+  }
+
+  // Position in the file including the bytes that are still buffered
+  uint32_t position() {
+    return file.position() + count;
+  }
+
+  uint16_t buffered() const {
+    return count;
+  }
+
+  uint32_t droppedBytes() const {
+    return dropped;
+  }
+
+  bool flushBuffer() {
+    if (count == 0) return true;
+    bool ok = file.write(buffer, count) == count;
+    count = 0;
+    limit = capacity;
+    return ok;
+  }
+
+  void close() {
+    flushBuffer();
+    file.close();
+  }
+};
+
+#endif
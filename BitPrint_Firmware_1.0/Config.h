@@ -5,22 +5,91 @@
 
 //SD configuration
 const int chipSelect = 53;
+const int sdSectorSize = 512;
+const int maxGcodeFiles = 20;   //files listed for selection
+const int fileNameSize = 13;    //8.3 name + terminator
+const int cacheFormatVersion = 2;  //part of the source ID, increase when the TXT / IDX format changes
+const int sourceIDSize = 64;       //bytes for the source ID at the start of the layer index
 bool fileNameIdentical = false;
-String baseGCO;  // keep selected base filename
+
+// Serial configuration:
+const long serialBaudRate = 250000;  //250000 has no baud rate error on a 16MHz Mega, 115200 for hosts that need it
+const int hostLineCount = 4;         //received lines buffered ahead of the parser, a host may keep this many without ok
+const unsigned long hostIdleMillis = 2000;       //a host that sent nothing for this long has paused, the queue may run empty
+const unsigned long hostKeepaliveMillis = 2000;  //"busy" interval while a host line waits for the SD print to finish
+void receiveSerial();  //defined in the sketch, moves received bytes out of the 64 byte RX buffer during long loops
+
+// Memory configuration (all buffers are allocated statically, nothing uses the heap):
+const int lineBufferSize = 96;      //longest G-code / TXT line, longer lines are cut off
+const int staticRamBudget = 5632;   //bytes for the global objects and buffers, checked at compile time
+const int minFreeStack = 512;       //warn if less stack than this was left during a print
 
 // General configuration:
 const float beltPitch = 2.0;
 const int pulleyTeeth = 20;
-const int microSteps = 4;       //check M0, M1, M2
+const int microSteps = 4;       //set on the drivers through the microstep pins below (or their jumpers)
 const int motorRevSteps = 200;  //number of steps for 1 revolution
 int speedMicros;
 
+// Diagnostics configuration:
+#define PROFILING_ENABLED 0          //scope timers + trace buffer, dump with M990
+#define LOG_LEVEL LOG_LEVEL_INFO     //LOG_LEVEL_DEBUG logs every parsed/executed line
+const int traceBufferSize = 32;      //trace events kept in RAM (8 bytes each)
+
+// Print log configuration (PRINTLOG.TXT, layer times and queue statistics):
+const bool printLogEnabled = false;
+const int printLogBufferSize = 128;  //bytes kept in RAM between SD writes
+const int logFlushQueueDepth = 12;   //only write to SD while this many moves are queued
+
+// Planner configuration:
+const int plannerBufferSize = 16;    //number of moves buffered ahead of the steppers
+const int slowdownQueueDepth = plannerBufferSize / 2;  //below this many queued moves short moves are slowed down
+const long minSegmentMicros = 20000; //shortest move duration while the queue is running low
+const int idleTickMicros = 1000;     //step timer period while there is nothing to step
+const int stepPulseMicros = 2;       //step pin high time, A4988 needs 1us and DRV8825 1.9us
+const int homingStepMicros = 400;    //step period while homing
+const int minStepDelayMicros = 100;  //shortest step timer period, the planner steps no faster at maxStepRate, M991 counts late ticks
+const int maxStepDelayMicros = 32767; //slowest step delay, the ramp starts at 1.5x of it and still fits 16 bits
+const int minOverridePercent = 10;   //limits for M220 / M221
+const int maxOverridePercent = 500;
+
+// Input shaping configuration (M593), X and Y only:
+#define INPUT_SHAPING_ENABLED 1
+const float shapingFrequencyX = 0;   //Hz, 0 = off until set with M593
+const float shapingFrequencyY = 0;
+const float shapingDamping = 0.1;
+const float minShapingFrequency = 20; //lowest M593 frequency, raised further for high damping so the impulses fit 16 bits of micros
+const int shaperQueueSize = 32;       //delayed steps per impulse and axis (5 bytes each)
+
+// Translation configuration:
+const float mergeToleranceMM = 0.02;        //max distance of a dropped point from the merged move
+const float mergeExtrusionTolerance = 0.05; //max relative difference in extrusion per mm of merged moves
+const int maxMergedSegments = 8;            //points that can be dropped from one merged move
+
+// Axis configuration:
+// Logical axes as stored in the TXT file, every motor below drives one of them
+enum { X_AXIS, Y_AXIS, Z_AXIS, E_AXIS };
+const int axisCount = 4;
+const char axisLetters[axisCount] = { 'X', 'Y', 'Z', 'E' };
+
+// Step rate configuration:
+const long maxStepRate[axisCount] = { 10000, 10000, 5000, 5000 };  //step pulses per second each axis can follow (X, Y, Z, E)
+#define ADAPTIVE_MICROSTEPPING 0   //travel moves limited by maxStepRate run at travelMicroSteps (needs the microstep pins)
+const int travelMicroSteps = 1;
+
+// Tool configuration:
+const int toolCount = 2;
+const int allTools = -1;                          //motor is used by every tool
+const float toolOffsetX[toolCount] = { 0.0, 0.0 };  //nozzle offset of each tool in mm
+const float toolOffsetY[toolCount] = { 0.0, 0.0 };
+
 // X-Stepper motor configuration:
 const int stepPinX = 28;
 const int dirPinX = 26;
 const int enablePinX = 5;
 const int limitSwitchX = 40;
 const float stepsPerMMX = (motorRevSteps * microSteps) / (pulleyTeeth * beltPitch);
+const int microstepPinsX[3] = { -1, -1, -1 };  //MS1, MS2, MS3, -1 = set by jumpers
 
 // Y-Stepper motor configuration:
 const int stepPinY = 24;
@@ -28,6 +97,7 @@ const int dirPinY = 22;
 const int enablePinY = 8;
 const int limitSwitchY = 40;
 const float stepsPerMMY = (motorRevSteps * microSteps) / (pulleyTeeth * beltPitch);
+const int microstepPinsY[3] = { -1, -1, -1 };  //MS1, MS2, MS3, -1 = set by jumpers
 
 // Z-Stepper motor configuration:
 const int stepPinZ = 32;
@@ -35,7 +105,16 @@ const int dirPinZ = 30;
 const int enablePinZ = 9;
 const int limitSwitchZ = 40;
 const float stepsPerMMZ = (motorRevSteps * microSteps) / (pulleyTeeth * beltPitch);
-float zOffset = 0,0;
+const int microstepPinsZ[3] = { -1, -1, -1 };  //MS1, MS2, MS3, -1 = set by jumpers
+float zOffset = 0.0;
+
+// Z2-Stepper motor configuration (second Z motor, follows Z):
+const int stepPinZ2 = 36;   //placeholder
+const int dirPinZ2 = 34;    //placeholder
+const int enablePinZ2 = 10; //placeholder
+const int limitSwitchZ2 = 38; //placeholder, each Z motor squares against its own switch
+static_assert(limitSwitchZ2 != limitSwitchZ, "the Z motors need separate limit switches for homing");
+const int microstepPinsZ2[3] = { -1, -1, -1 }; //MS1, MS2, MS3, -1 = set by jumpers
 
 // E-Stepper motor configuration:
 const int stepPinE = 50;
@@ -43,5 +122,19 @@ const int dirPinE = 50;
 const int enablePinE = 50;
 const int limitSwitchE = 50;
 const float stepsPerMME = (motorRevSteps * microSteps) / (pulleyTeeth * beltPitch);
+const int microstepPinsE[3] = { -1, -1, -1 };  //MS1, MS2, MS3, -1 = set by jumpers
+
+// E1-Stepper motor configuration (extruder of tool T1):
+const int stepPinE1 = 42;   //placeholder
+const int dirPinE1 = 44;    //placeholder
+const int enablePinE1 = 12; //placeholder
+const int limitSwitchE1 = 50;
+const float stepsPerMME1 = (motorRevSteps * microSteps) / (pulleyTeeth * beltPitch);
+const int microstepPinsE1[3] = { -1, -1, -1 }; //MS1, MS2, MS3, -1 = set by jumpers
+
+// Motor table: which logical axis and tool every motor belongs to (same order as in the .ino)
+const int motorCount = 6;
+const int motorAxis[motorCount] = { X_AXIS, Y_AXIS, Z_AXIS, Z_AXIS, E_AXIS, E_AXIS };
+const int motorTool[motorCount] = { allTools, allTools, allTools, allTools, 0, 1 };
 
 #endif
\ No newline at end of file
@@ -3,63 +3,285 @@
 
 #include <Arduino.h>
 #include "StepperController.h"
+#include "LayerIndex.h"
+#include "Profiler.h"
+#include "BufferedWriter.h"
+#include "LineBuffer.h"
+#include "MemoryMonitor.h"
+#include "SerialReceiver.h"
+
+uint8_t printLogBuffer[printLogBufferSize];
 
 class Executor {
 private:
   MotionPlanner& motionPlanner;
+  SerialReceiver& receiver;
   bool M84Active;
+  bool printingFile;  // serial lines are overrides while a TXT file is printed, otherwise they belong to the host
+  int layerTotal;
+  char line[lineBufferSize];
+  BufferedWriter printLog;
+  bool logging;
+  unsigned long lastBusyMillis;
+
+  void openPrintLog() {
+    logging = false;
+    if (!printLogEnabled) return;
+    File logFile = SD.open("PRINTLOG.TXT", FILE_WRITE);
+    if (!logFile) return;
+    printLog.begin(logFile, true);
+    logging = true;
+    printLog.print("Start ");
+    printLog.println(millis() / 1000);
+  }
+
+  // Log data only goes to the card while enough moves are queued to cover the SD write
+  void servicePrintLog() {
+    if (logging && printLog.buffered() > 0 && motionPlanner.queuedBlocks() >= logFlushQueueDepth) {
+      printLog.flushBuffer();
+    }
+  }
+
+  void closePrintLog() {
+    if (!logging) return;
+    printLog.print("End ");
+    printLog.println(millis() / 1000);
+    printLog.print("Dropped ");
+    printLog.println(printLog.droppedBytes());
+    printLog.close();
+    logging = false;
+  }
 
 public:
-  Executor(MotionPlanner& mp) : motionPlanner(mp), M84Active(false) {}
-  
-  void excecuteTargetFile(File& target) {
+  Executor(MotionPlanner& mp, SerialReceiver& sr)
+    : motionPlanner(mp), receiver(sr), M84Active(false), printingFile(false), layerTotal(0),
+      printLog(printLogBuffer, sizeof(printLogBuffer)), logging(false), lastBusyMillis(0) {}
+
+  // M593 [X] [Y] [F<frequency>] [D<damping>] [T<0 = ZV, 1 = MZV, 2 = EI>], without X or Y both axes are set
+  void handleShaperCommand(const char* command) {
+    bool x = strchr(command, 'X') != 0;
+    bool y = strchr(command, 'Y') != 0;
+    if (!x && !y) x = y = true;
+
+    const char* valueF = strchr(command, 'F');
+    const char* valueD = strchr(command, 'D');
+    const char* valueT = strchr(command, 'T');
+    for (int axis = 0; axis < 2; axis++) {
+      if (axis == 0 ? !x : !y) continue;
+      if (valueF || valueD || valueT) {
+        motionPlanner.configureShaper(axis,
+                                      valueT ? atoi(valueT + 1) : motionPlanner.getShaperType(axis),
+                                      valueF ? atof(valueF + 1) : motionPlanner.getShaperFrequency(axis),
+                                      valueD ? atof(valueD + 1) : motionPlanner.getShaperDamping(axis));
+      }
+      motionPlanner.printShaper(axis);
+    }
+  }
+
+  // Handles M220 (feedrate) and M221 (flow) overrides, M593 (input shaping), M990 (profiler dump)
+  // M991 (queue statistics) and M992 (memory report), returns false for any other line
+  bool handleOverrideCommand(const char* command) {
+    if (lineStartsWith(command, "M990")) {
+      PROFILE_DUMP();
+      return true;
+    } else if (lineStartsWith(command, "M991")) {
+      motionPlanner.printQueueStats();
+      return true;
+    } else if (lineStartsWith(command, "M992")) {
+      MemoryMonitor::printReport();
+      return true;
+    } else if (lineStartsWith(command, "M593")) {
+      handleShaperCommand(command);
+      return true;
+    }
+
+    bool feed = lineStartsWith(command, "M220");
+    bool flow = lineStartsWith(command, "M221");
+    if (!feed && !flow) return false;
+
+    const char* value = strchr(command, 'S');
+    if (value) {
+      int percent = atoi(value + 1);
+      if (feed) motionPlanner.setFeedratePercent(percent);
+      else motionPlanner.setFlowPercent(percent);
+    }
+
+    Serial.print(feed ? "Feedrate: " : "Flow: ");
+    Serial.print(feed ? motionPlanner.getFeedratePercent() : motionPlanner.getFlowPercent());
+    Serial.println("%");
+    return true;
+  }
+
+  // Collects serial input without blocking. During an SD print overrides are handled right away,
+  // any other line stays queued without its ok until the print is done, so the host waits for it
+  void pollSerial() {
+    PROFILE_SERVICE();
+    servicePrintLog();
+    receiver.poll();
+    while (printingFile && receiver.available()) {
+      if (!handleOverrideCommand(receiver.line())) {
+        if (millis() - lastBusyMillis >= hostKeepaliveMillis) {
+          lastBusyMillis = millis();
+          Serial.println("echo:busy: printing from SD");
+        }
+        return;
+      }
+      receiver.next();
+    }
+  }
+
+  // Waits until all queued moves are done, serial input is still received meanwhile.
+  // The queue runs empty on purpose, that is no underrun.
+  void waitForMotion() {
+    bool streaming = motionPlanner.isStreaming();
+    motionPlanner.setStreaming(false);
+    while (!motionPlanner.idle()) {
+      pollSerial();
+      yield();
+    }
+    motionPlanner.setStreaming(streaming);
+  }
+
+  // Runs one TXT record: a move (M), G28, M84, T, a layer marker (L) or an override
+  void executeRecord(const char* record) {
+    if (lineStartsWith(record, "M220") || lineStartsWith(record, "M221") || lineStartsWith(record, "M593")) {
+      // an override or shaper setting from the file only applies to the moves after it, unlike a live
+      // one from serial that also changes the queued moves
+      waitForMotion();
+      handleOverrideCommand(record);
+    } else if (handleOverrideCommand(record)) {
+      return;
+    } else if (record[0] == ';') {
+      // source ID in the first line of the cache
+    } else if (record[0] == 'L') {
+      LOG_INFO("Layer ");
+      LOG_INFO(atoi(record + 1) + 1);
+      LOG_INFO("/");
+      LOG_INFOLN(layerTotal);
+      if (logging) {
+        printLog.print(record);
+        printLog.print(" ");
+        printLog.println(millis() / 1000);
+      }
+    } else if (lineStartsWith(record, "M84")) {
+      waitForMotion();
+      motionPlanner.enableAllAxes();
+      M84Active = true;
+    } else if (record[0] == 'M') {
+      int steps[axisCount];
+      for (int i = 0; i < axisCount; i++) {
+        steps[i] = 0;
+        const char* value = strchr(record, axisLetters[i]);
+        if (value)
+          steps[i] = atoi(value + 1);
+      }
+
+      const char* value = strchr(record, 'S');
+      if (value)
+        speedMicros = atoi(value + 1);
+
+      // wait for room in the queue, checking for overrides meanwhile
+      while (motionPlanner.queueFull()) {
+        pollSerial();
+        yield();
+      }
+      motionPlanner.queueMove(steps, speedMicros);
+      // host moves were translated just now and are in the positions already
+      if (printingFile) motionPlanner.addToPositions(steps);
+    } else if (record[0] == 'T') {
+      motionPlanner.selectTool(atoi(record + 1));
+    } else if (lineStartsWith(record, "G28")) {
+      Serial.println("Homing all axes...");
+      waitForMotion();
+      motionPlanner.homeAllAxes();
+    } else {
+      LOG_ERROR("Unknown command in target: ");
+      LOG_ERRORLN(record);
+    }
+  }
+
+  // Applies the feedrate, flow and shaper records of the TXT file before the given offset,
+  // so a resumed print runs with the settings it would have had when printed from the start
+  void replayOverrides(File& target, uint32_t end) {
+    target.seek(0);
+    while (target.available() && target.position() < end) {
+      readLine(target, line, sizeof(line));
+      if (lineStartsWith(line, "M220") || lineStartsWith(line, "M221") || lineStartsWith(line, "M593")) {
+        handleOverrideCommand(line);
+      }
+    }
+  }
+
+  // Homes, moves to the start of the layer (Z first, then X/Y) and continues the TXT file from there
+  bool seekToLayer(File& target, LayerIndex& index, int layer) {
+    LayerIndexEntry entry;
+    if (!index.read(layer, entry)) {
+      Serial.print("Layer not in index: ");
+      Serial.println(layer);
+      return false;
+    }
+
+    waitForMotion();
+    motionPlanner.homeAllAxes();
+    motionPlanner.selectTool(entry.tool);
+    speedMicros = entry.speedMicros;
+
+    // the modal speed of the layer is meant for X/Y, Z rises at the homing speed
+    int steps[axisCount] = { 0 };
+    steps[Z_AXIS] = entry.positionSteps[Z_AXIS];
+    motionPlanner.queueMove(steps, homingStepMicros);
+    motionPlanner.addToPositions(steps);
+    steps[Z_AXIS] = 0;
+    steps[X_AXIS] = entry.positionSteps[X_AXIS];
+    steps[Y_AXIS] = entry.positionSteps[Y_AXIS];
+    motionPlanner.queueMove(steps, speedMicros);
+    motionPlanner.addToPositions(steps);
+    waitForMotion();
+    replayOverrides(target, entry.cacheOffset);
+
+    Serial.print("Resuming at layer ");
+    Serial.print(layer + 1);  // layers are numbered from 1 at the prompt
+    Serial.print(", Z=");
+    Serial.println(entry.z);
+    return target.seek(entry.cacheOffset);
+  }
+
+  void excecuteTargetFile(File& target, LayerIndex& index, int startLayer) {
+    printingFile = true;
+    motionPlanner.selectTool(0);
+    if (startLayer > 0 && !seekToLayer(target, index, startLayer)) {
+      printingFile = false;
+      target.close();
+      return;
+    }
+
+    motionPlanner.resetQueueStats();
+    motionPlanner.setStreaming(true);
+    layerTotal = index.layerCount();
+    openPrintLog();
     while (target.available()) {
-      String line = target.readStringUntil('\n');
-      line.trim();
-      if (line.length() == 0) continue;
-
-      Serial.print("Executing line: ");
-      Serial.println(line);
-
-      if (line.startsWith("M84")) {
-        motionPlanner.enableAllAxes();
-        M84Active = true;
-      } else if (line.startsWith("M")) {
-        int stepsX = 0, stepsY = 0, stepsZ = 0, stepsE = 0;
-
-        int idx = line.indexOf('X');
-        if (idx != -1)
-          stepsX = line.substring(idx + 1, line.indexOf('Y', idx)).toInt();
-
-        idx = line.indexOf('Y');
-        if (idx != -1)
-          stepsY = line.substring(idx + 1, line.indexOf('Z', idx)).toInt();
-
-        idx = line.indexOf('Z');
-        if (idx != -1)
-          stepsZ = line.substring(idx + 1, line.indexOf('E', idx)).toInt();
-
-        idx = line.indexOf('E');
-        if (idx != -1)
-          stepsE = line.substring(idx + 1).toInt();
-
-        idx = line.indexOf('S');
-        if (idx != -1)
-          speedMicros = line.substring(idx + 1).toInt();
-
-        motionPlanner.moveXYZE(stepsX, stepsY, stepsZ, stepsE, speedMicros);
-      } else if (line.startsWith("G28")) {
-        Serial.println("Homing all axes...");
-        motionPlanner.homeAllAxes();
-      } else {
-        Serial.print("Unknown command in target: ");
-        Serial.println(line);
+      int length;
+      {
+        PROFILE_SCOPE(ZONE_SD_READ);
+        length = readLine(target, line, sizeof(line));
       }
+      if (length == 0) continue;
+
+      LOG_DEBUG("Executing line: ");
+      LOG_DEBUGLN(line);
+      executeRecord(line);
     }
 
+    waitForMotion();
+    motionPlanner.setStreaming(false);
+    printingFile = false;
+
     Serial.println("Print finished!");
+    motionPlanner.printQueueStats();
+    MemoryMonitor::printReport();
+    closePrintLog();
     target.close();
   }
 };
 
-#endif
\ No newline at end of file
+#endif
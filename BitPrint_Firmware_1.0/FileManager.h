@@ -7,22 +7,59 @@
 #include <SPI.h>
 #include <SD.h>
 #include "Executor.h"
+#include "LineBuffer.h"
 
 class GcodeParser;
 
+// CRC32 (reflected polynomial 0xEDB88320), one entry per 4 bits
+const uint32_t crc32Table[16] PROGMEM = {
+  0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+  0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
 class FileManager {
 private:
   int chipSelect;
   GcodeParser* parser;  // pointer to GcodeParser
   MotionPlanner* planner; 
-  String gcodeFiles[20];
+  SerialReceiver* receiver;  // answers to the prompts arrive like any other line
+  Executor executor;
+  char gcodeFiles[maxGcodeFiles][fileNameSize];
   int fileCount;
   File root;
   File entry;
   int selectedIndex;
+
+  // ID of a .gco file, written as first line of its TXT cache: cache format version, size and CRC32
+  // of the whole source, so a re-sliced file with the same name is translated again
+  static bool makeSourceID(const char* gcoFileName, char* id, int size) {
+    File source = SD.open(gcoFileName);
+    if (!source) return false;
+    uint32_t crc = 0xFFFFFFFF;
+    uint8_t buffer[64];
+    int count;
+    while ((count = source.read(buffer, sizeof(buffer))) > 0) {
+      receiveSerial();
+      for (int i = 0; i < count; i++) {
+        crc ^= buffer[i];
+        crc = (crc >> 4) ^ pgm_read_dword(&crc32Table[crc & 0x0F]);
+        crc = (crc >> 4) ^ pgm_read_dword(&crc32Table[crc & 0x0F]);
+      }
+    }
+    unsigned long length = source.size();
+    source.close();
+    snprintf(id, size, ";BitPrint cache %d, source %lu bytes, CRC32 %08lX", cacheFormatVersion, length,
+             (unsigned long)~crc);
+    return true;
+  }
+
 public:
-  FileManager(int cs, GcodeParser* p, MotionPlanner* mp)
-    : chipSelect(cs), parser(p), planner(mp), fileCount(0) {}
+  FileManager(int cs, GcodeParser* p, MotionPlanner* mp, SerialReceiver* sr)
+    : chipSelect(cs), parser(p), planner(mp), receiver(sr), executor(*mp, *sr), fileCount(0) {}
+
+  Executor& getExecutor() {
+    return executor;
+  }
 
   void initializeSD() {
     Serial.println("Initializing SD card...");
@@ -39,32 +76,28 @@ public:
     int index = 1;
     Serial.println("GCODE files on SD card:");
 
-    while (true) {
+    while (fileCount < maxGcodeFiles) {
       entry = root.openNextFile();
       if (!entry) break;
 
-      String nameGCO = entry.name();
-      if (nameGCO.endsWith(".gco") || nameGCO.endsWith(".GCO")) {
+      const char* nameGCO = entry.name();
+      if (hasExtension(nameGCO, "GCO") && strlen(nameGCO) < fileNameSize) {
         Serial.print(index);
         Serial.print(": ");
         Serial.println(nameGCO);
-        gcodeFiles[fileCount] = nameGCO;
+        strcpy(gcodeFiles[fileCount], nameGCO);
         fileCount++;
         index++;
       }
       entry.close();
     }
+    root.close();  // a File that is reassigned without close() leaks its heap allocation
     Serial.println("END LIST");
   }
 
-  String selectFile() {
-    Serial.println("Type the number of the file you want to select:");
-    while (Serial.available() == 0) {
-      // wait for user input
-    }
-
-    String input = Serial.readStringUntil('\n');
-    selectedIndex = input.toInt() - 1;
+  // number as shown by listGcodeFiles(), starting at 1
+  void selectFile(int number) {
+    selectedIndex = number - 1;
 
     if (selectedIndex < 0 || selectedIndex >= fileCount) {
       Serial.println("Invalid selection.");
@@ -73,8 +106,6 @@ public:
 
     Serial.print("You selected file: ");
     Serial.println(gcodeFiles[selectedIndex]);
-    baseGCO = gcodeFiles[selectedIndex];
-    baseGCO.remove(baseGCO.lastIndexOf('.'));  // strip extension
 
     checkMatchingTxtFile();
   }
@@ -83,36 +114,32 @@ public:
     // Check for matching TXT file
     Serial.println("Searching for identical TXT file...");
     fileNameIdentical = false;  // reset flag
+    char txtFileName[fileNameSize];
+    char idxFileName[fileNameSize];
+    replaceExtension(txtFileName, sizeof(txtFileName), gcodeFiles[selectedIndex], "TXT");
+    replaceExtension(idxFileName, sizeof(idxFileName), gcodeFiles[selectedIndex], "IDX");
+
     root = SD.open("/");
     while (true) {
       entry = root.openNextFile();
       if (!entry) break;
 
-      String nameTXT = entry.name();
-      if (nameTXT.endsWith(".TXT") || nameTXT.endsWith(".txt")) {
-        String baseTXT = nameTXT;
-        baseTXT.remove(baseTXT.lastIndexOf('.'));
-        if (baseTXT == baseGCO) {
-          fileNameIdentical = true;
-        }
+      if (strcasecmp(entry.name(), txtFileName) == 0) {
+        fileNameIdentical = true;
       }
       entry.close();
     }
-
-    String txtFileName = baseGCO + ".TXT";
+    root.close();
 
     if (fileNameIdentical) {
       Serial.println("Identical TXT file found, checking IDs...");
 
-      File source = SD.open(gcodeFiles[selectedIndex]);
+      char sourceID[lineBufferSize];
       File target = SD.open(txtFileName);
 
-      if (source && target) {
-        String sourceID = readFirstLine(source);
-        String targetID = readFirstLine(target);
-        sourceID.trim();
-        targetID.trim();
-        source.close();
+      if (makeSourceID(gcodeFiles[selectedIndex], sourceID, sizeof(sourceID)) && target) {
+        char targetID[lineBufferSize];
+        readLine(target, targetID, sizeof(targetID));
         target.close();
 
         Serial.print("Source ID: ");
@@ -120,54 +147,74 @@ public:
         Serial.print("Target ID: ");
         Serial.println(targetID);
 
-        if (sourceID == targetID) {
-          Serial.println("IDs match -> Executing TXT file...");
-        } else {
+        LayerIndex layerIndex;
+        bool indexMatches = layerIndex.open(idxFileName) && layerIndex.belongsTo(sourceID);
+        layerIndex.close();
+
+        if (strcmp(sourceID, targetID) != 0) {
           Serial.println("IDs do not match -> Overwriting TXT file...");
-          SD.remove(txtFileName);
-          File newTarget = SD.open(txtFileName, FILE_WRITE);
-          if (newTarget) {
-            newTarget.println(sourceID);
-            newTarget.close();
-            parser->processGCODE((char*)gcodeFiles[selectedIndex].c_str(), (char*)txtFileName.c_str());
-          }
+          createTxtFile(gcodeFiles[selectedIndex], txtFileName, idxFileName);
+        } else if (!indexMatches) {
+          Serial.println("Layer index missing or out of date -> Overwriting TXT file...");
+          createTxtFile(gcodeFiles[selectedIndex], txtFileName, idxFileName);
+        } else {
+          Serial.println("IDs match -> Executing TXT file...");
         }
       } else {
+        if (target) target.close();
         Serial.println("Error opening files for comparison.");
       }
 
     } else {
       Serial.println("No identical TXT file found -> Creating new file...");
-      File newTarget = SD.open(txtFileName, FILE_WRITE);
-      if (newTarget) {
-        File source = SD.open(gcodeFiles[selectedIndex]);
-        if (source) {
-          String sourceID = readFirstLine(source);
-          source.close();
-          newTarget.println(sourceID);
-        }
-        newTarget.close();
-        parser->processGCODE((char*)gcodeFiles[selectedIndex].c_str(), (char*)txtFileName.c_str());
-      }
+      createTxtFile(gcodeFiles[selectedIndex], txtFileName, idxFileName);
     }
 
     File toExecute = SD.open(txtFileName, FILE_READ);
     if (toExecute) {
-      Executor executor(*planner);
-      executor.excecuteTargetFile(toExecute);
+      LayerIndex layerIndex;
+      layerIndex.open(idxFileName);
+      int startLayer = selectStartLayer(layerIndex);
+      executor.excecuteTargetFile(toExecute, layerIndex, startLayer);
+      layerIndex.close();
     } else {
       Serial.println("Error: could not reopen TXT for execution");
     }
   }
 
-  String readFirstLine(File file) {
-    String line = "";
-    while (file.available()) {
-      char c = file.read();
-      if (c == '\n') break;  // stop at first newline
-      line += c;
+  // Writes the source ID as first line of a new TXT file and translates the G-code into it.
+  // The host preprocessing tool (HostTools/gcode2txt) calls this too, so both write the same cache.
+  bool createTxtFile(const char* gcoFileName, const char* txtFileName, const char* idxFileName) {
+    char sourceID[lineBufferSize];
+    if (!makeSourceID(gcoFileName, sourceID, sizeof(sourceID))) {
+      Serial.println("Error opening G-code file.");
+      return false;
+    }
+
+    SD.remove(txtFileName);
+    File newTarget = SD.open(txtFileName, FILE_WRITE);
+    if (!newTarget) {
+      Serial.println("Error creating TXT file.");
+      return false;
     }
-    return line;
+    newTarget.println(sourceID);
+    newTarget.close();
+    parser->processGCODE(gcoFileName, txtFileName, idxFileName, sourceID);
+    return true;
+  }
+
+  int selectStartLayer(LayerIndex& layerIndex) {
+    if (layerIndex.layerCount() == 0) {
+      Serial.println("No layer index, starting at the first layer.");
+      return 0;
+    }
+
+    Serial.print("Type the layer to start at (1-");
+    Serial.print(layerIndex.layerCount());
+    Serial.println("), or 0 to start from the beginning:");
+    int layer = receiver->readNumber();
+    if (layer < 1 || layer > layerIndex.layerCount()) return 0;
+    return layer - 1;
   }
 };
 
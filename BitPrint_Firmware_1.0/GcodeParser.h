@@ -4,152 +4,398 @@
 #include <Arduino.h>
 #include <SD.h>
 #include "StepperController.h"
+#include "LayerIndex.h"
+#include "Profiler.h"
+#include "BufferedWriter.h"
+#include "LineBuffer.h"
+
+uint8_t cacheSectorBuffer[sdSectorSize];  // the TXT cache is written in whole sectors
+
+// Positioning state of the host session, kept across the translation of an SD file
+struct SessionState {
+  int activeTool;
+  bool relativeAxes;
+  bool relativeExtrusion;
+  float axisOffset[axisCount];
+  float feedrate;
+  float positions[motorCount];
+};
 
 class GcodeParser {
 private:
   MotionPlanner& planner;
-  StepperController& stepperX;
-  StepperController& stepperY;
-  StepperController& stepperZ;
-  StepperController& stepperE;
+  int activeTool;
+  char line[lineBufferSize];
+  LayerIndex layerIndex;
+  LayerIndexEntry pendingLayer;  // written once its ;Z: comment has been seen or the next layer starts
+  bool layerPending;
+  int layerCount;
 
-public:
-  GcodeParser(MotionPlanner& p, StepperController& x, StepperController& y, StepperController& z, StepperController& e)
-    : planner(p), stepperX(x), stepperY(y), stepperZ(z), stepperE(e) {}
-
-  void parseGcodeLine(File& source, File& target) {
-    float x = NAN;
-    float y = NAN;
-    float z = NAN;
-    float e = NAN;
-    float s = NAN;
+  // Positioning state (G90/G91, M82/M83, G92)
+  bool relativeAxes;
+  bool relativeExtrusion;
+  float axisOffset[axisCount];  // G92 offset between G-code and machine coordinates
+  float positionCarry[axisCount];  // what float rounding took off the relative moves so far
+  float feedrate;               // modal F in mm/min, NAN until the first F
 
-    String line = source.readStringUntil('\n');
-    line.trim();
-    int spaceIndex = line.indexOf(' ');
-    String CMD = (spaceIndex > 0) ? line.substring(0, spaceIndex) : line;
+  // Move that is still being extended by following collinear moves, written by flushMove()
+  bool movePending;
+  float moveStart[axisCount];   // machine positions in mm
+  float moveEnd[axisCount];
+  float moveFeedrate;
+  float mergedPoints[maxMergedSegments][2];  // X/Y of the points dropped so far
+  int mergedCount;
+  int writtenSpeedMicros;          // last S written to the TXT file
 
-    if (CMD == "G0" || CMD == "G1") {
-      Serial.print(CMD);
-      Serial.print(" line detected including: ");
+  // Translation statistics
+  long parsedMoves;
+  long writtenMoves;
+  long droppedMoves;
+  float maxDeviation;
 
-      int index;
-      index = line.indexOf('X');
-      if (index != -1) {
-        x = line.substring(index + 1).toFloat();
-        Serial.print("X ");
-      }
+  static float distanceXY(const float a[], const float b[]) {
+    float dx = b[X_AXIS] - a[X_AXIS];
+    float dy = b[Y_AXIS] - a[Y_AXIS];
+    return sqrt(dx * dx + dy * dy);
+  }
 
-      index = line.indexOf('Y');
-      if (index != -1) {
-        y = line.substring(index + 1).toFloat();
-        Serial.print("Y ");
-      }
+  // Distance of point p from the segment a-b, or -1 if p does not project onto the segment
+  static float deviationFromSegment(const float a[], const float b[], float px, float py) {
+    float dx = b[X_AXIS] - a[X_AXIS];
+    float dy = b[Y_AXIS] - a[Y_AXIS];
+    float lengthSq = dx * dx + dy * dy;
+    if (lengthSq == 0) return -1;
+    float t = ((px - a[X_AXIS]) * dx + (py - a[Y_AXIS]) * dy) / lengthSq;
+    if (t < 0 || t > 1) return -1;
+    return abs((px - a[X_AXIS]) * dy - (py - a[Y_AXIS]) * dx) / sqrt(lengthSq);
+  }
 
-      index = line.indexOf('Z');
-      if (index != -1) {
-        z = line.substring(index + 1).toFloat();
-        Serial.print("Z ");
-      }
-      index = line.indexOf('E');
-      if (index != -1) {
-        e = line.substring(index + 1).toFloat();
-        Serial.print("E ");
-      }
+  // A move can extend the pending one if it keeps tool, feedrate, Z and extrusion per mm
+  // and every dropped point stays within mergeToleranceMM of the merged move
+  bool canMerge(const float target[], float& deviation) {
+    if (!movePending || mergedCount >= maxMergedSegments) return false;
+    if (moveFeedrate != feedrate && !(isnan(moveFeedrate) && isnan(feedrate))) return false;
+    if (moveStart[Z_AXIS] != moveEnd[Z_AXIS] || target[Z_AXIS] != moveEnd[Z_AXIS]) return false;
 
-      index = line.indexOf('F');
-      if (index != -1) {
-        s = line.substring(index + 1).toFloat();
-        Serial.print("F ");
-      }
+    float pendingLength = distanceXY(moveStart, moveEnd);
+    float newLength = distanceXY(moveEnd, target);
+    if (pendingLength == 0 || newLength == 0) return false;
 
-      Serial.println("");
-
-      translateG(x, y, z, e, s, target);
+    float pendingE = moveEnd[E_AXIS] - moveStart[E_AXIS];
+    float newE = target[E_AXIS] - moveEnd[E_AXIS];
+    if ((pendingE == 0) != (newE == 0)) return false;
+    if (pendingE != 0) {
+      float pendingRatio = pendingE / pendingLength;
+      float newRatio = newE / newLength;
+      if (abs(newRatio - pendingRatio) > mergeExtrusionTolerance * abs(pendingRatio)) return false;
+    }
 
-    } else if (CMD == "G28") { //home all axes
-      target.println(CMD);
-      Serial.println("G28 line detected");
-    } else if (CMD == "M84") { //enable all steppers
-      target.println(CMD);
-      Serial.println("M84 line detected");
-    } else {
-      Serial.println("no matching start code... ignoring line");
+    deviation = deviationFromSegment(moveStart, target, moveEnd[X_AXIS], moveEnd[Y_AXIS]);
+    if (deviation < 0 || deviation > mergeToleranceMM) return false;
+    for (int i = 0; i < mergedCount; i++) {
+      float d = deviationFromSegment(moveStart, target, mergedPoints[i][0], mergedPoints[i][1]);
+      if (d < 0 || d > mergeToleranceMM) return false;
+      if (d > deviation) deviation = d;
     }
+    return true;
   }
 
-  void translateG(float parsedX, float parsedY, float parsedZ, float parsedE, float parsedS, File& target)
-  //Method for translating the G command line in gcode
-  //by parsing the values, calculating steps and writing to a translated file
-  {
-    int stepsX = 0;
-    int stepsY = 0;
-    int stepsZ = 0;
-    int stepsE = 0;
+  // Machine position the next move starts from
+  float currentPosition(int axis) {
+    return movePending ? moveEnd[axis] : planner.getMotor(axis, activeTool).getCurrentPos();
+  }
+
+  float toolOffset(int axis) const {
+    if (axis == X_AXIS) return toolOffsetX[activeTool];
+    if (axis == Y_AXIS) return toolOffsetY[activeTool];
+    if (axis == Z_AXIS) return zOffset;
+    return 0;
+  }
+
+  // Writes the pending move as one M line, moves that do not reach the next step are dropped,
+  // the machine position stays where it is so the distance is added to the next move
+  void flushMove(Print& target) {
+    if (!movePending) return;
+    movePending = false;
 
     bool moved = false;
     char line[64];
     strcpy(line, "M");  // Start line with 'M'
 
-    // Only move axes that were actually provided (not 0 by default)
-    if (!isnan(parsedX)) {
-      stepsX = planner.calculateSteps(stepperX, stepperX.getCurrentPos(), parsedX);
-      stepperX.setCurrentPos(parsedX);
-      if (stepsX != 0) {
+    for (int i = 0; i < axisCount; i++) {
+      StepperController& motor = planner.getMotor(i, activeTool);
+      long steps = planner.calculateSteps(motor, moveEnd[i]);
+      motor.setCurrentPos(moveEnd[i]);
+      if (steps != 0) {
         char temp[12];
-        sprintf(temp, "X%d", stepsX);
+        sprintf(temp, "%c%ld", axisLetters[i], steps);
         strcat(line, temp);
         moved = true;
       }
     }
 
-    if (!isnan(parsedY)) {
-      stepsY = planner.calculateSteps(stepperY, stepperY.getCurrentPos(), parsedY);
-      stepperY.setCurrentPos(parsedY);
-      if (stepsY != 0) {
+    if (!moved) {
+      droppedMoves++;
+      return;
+    }
+
+    if (!isnan(moveFeedrate)) {
+      // clamped before the conversion, a very low feedrate would not fit the int
+      int moveSpeedMicros = min(1000000 / ((moveFeedrate / 60) * planner.getMotor(X_AXIS, activeTool).getStepsPerMM()),
+                                (float)maxStepDelayMicros);
+      if (moveSpeedMicros != writtenSpeedMicros) {
+        speedMicros = moveSpeedMicros;
+        writtenSpeedMicros = moveSpeedMicros;
         char temp[12];
-        sprintf(temp, "Y%d", stepsY);
+        sprintf(temp, "S%d", speedMicros);
         strcat(line, temp);
-        moved = true;
       }
     }
 
-    if (!isnan(parsedZ)) {
-      float compensatedZ = parsedZ + zOffset;
-      stepsZ = planner.calculateSteps(stepperZ, stepperZ.getCurrentPos(), compensatedZ);
-      stepperZ.setCurrentPos(compensatedZ);
-      if (stepsZ != 0) {
-        char temp[12];
-        sprintf(temp, "Z%d", stepsZ);
-        strcat(line, temp);
-        moved = true;
+    target.println(line);
+    writtenMoves++;
+  }
+
+  void resetTranslation() {
+    activeTool = 0;
+    layerPending = false;
+    layerCount = 0;
+    relativeAxes = false;
+    relativeExtrusion = false;
+    feedrate = NAN;
+    movePending = false;
+    writtenSpeedMicros = -1;
+    for (int i = 0; i < axisCount; i++) {
+      axisOffset[i] = 0;
+      positionCarry[i] = 0;
+    }
+    parsedMoves = 0;
+    writtenMoves = 0;
+    droppedMoves = 0;
+    maxDeviation = 0;
+  }
+
+  void saveSession(SessionState& session) const {
+    session.activeTool = activeTool;
+    session.relativeAxes = relativeAxes;
+    session.relativeExtrusion = relativeExtrusion;
+    for (int i = 0; i < axisCount; i++) {
+      session.axisOffset[i] = axisOffset[i];
+    }
+    session.feedrate = feedrate;
+    planner.getPositions(session.positions);
+  }
+
+  void restoreSession(const SessionState& session) {
+    activeTool = session.activeTool;
+    relativeAxes = session.relativeAxes;
+    relativeExtrusion = session.relativeExtrusion;
+    for (int i = 0; i < axisCount; i++) {
+      axisOffset[i] = session.axisOffset[i];
+      positionCarry[i] = 0;
+    }
+    feedrate = session.feedrate;
+    planner.setPositions(session.positions);
+    writtenSpeedMicros = -1;  // the translation changed speedMicros, the next move writes its S again
+  }
+
+  void startLayer(uint32_t sourceOffset, BufferedWriter& target) {
+    flushMove(target);
+    finishLayer();
+    pendingLayer.sourceOffset = sourceOffset;
+    pendingLayer.cacheOffset = target.position();
+    for (int i = 0; i < axisCount; i++) {
+      pendingLayer.positionSteps[i] = planner.getMotor(i, activeTool).getCurrentSteps();
+    }
+    pendingLayer.z = planner.getMotor(Z_AXIS, activeTool).getCurrentPos() - zOffset;
+    pendingLayer.speedMicros = speedMicros;
+    pendingLayer.tool = activeTool;
+    layerPending = true;
+
+    target.print("L");
+    target.println(layerCount);
+    layerCount++;
+  }
+
+  void finishLayer() {
+    if (!layerPending) return;
+    layerIndex.add(pendingLayer);
+    layerPending = false;
+  }
+
+public:
+  GcodeParser(MotionPlanner& p)
+    : planner(p) {
+    resetTranslation();
+  }
+
+  void parseGcodeLine(File& source, BufferedWriter& target) {
+    PROFILE_SCOPE(ZONE_PARSER);
+    uint32_t lineOffset = source.position();
+    {
+      PROFILE_SCOPE(ZONE_SD_READ);
+      readLine(source, line, sizeof(line));
+    }
+
+    // slicer layer comments, used for the layer index
+    if (lineStartsWith(line, ";LAYER_CHANGE")) {
+      startLayer(lineOffset, target);
+      return;
+    } else if (lineStartsWith(line, ";Z:")) {
+      if (layerPending) pendingLayer.z = atof(line + 3);
+      return;
+    }
+
+    translateLine(line, target);
+  }
+
+  // Translates one G-code line into TXT records, used for SD files and for lines from a serial host.
+  // Moves can stay pending to be merged with the next line, flushPendingMove() writes them.
+  void translateLine(char* line, Print& target) {
+    float parsed[axisCount];
+    float s = NAN;
+
+    char* comment = strchr(line, ';');
+    if (comment) {
+      *comment = '\0';
+      trimLine(line);
+    }
+
+    if (isCommand(line, "G0") || isCommand(line, "G1")) {
+      LOG_DEBUG(line[1] == '0' ? "G0" : "G1");
+      LOG_DEBUG(" line detected including: ");
+
+      const char* value;
+      for (int i = 0; i < axisCount; i++) {
+        parsed[i] = NAN;
+        value = strchr(line, axisLetters[i]);
+        if (value) {
+          parsed[i] = atof(value + 1);
+          LOG_DEBUG(axisLetters[i]);
+          LOG_DEBUG(" ");
+        }
+      }
+
+      value = strchr(line, 'F');
+      if (value) {
+        s = atof(value + 1);
+        LOG_DEBUG("F ");
+      }
+
+      LOG_DEBUGLN("");
+
+      translateG(parsed, s, target);
+
+    } else if (isCommand(line, "G28")) { //home all axes
+      flushMove(target);
+      target.println("G28");
+      for (int i = 0; i < axisCount; i++) {
+        if (i == E_AXIS) continue;
+        planner.getMotor(i, activeTool).setCurrentPos(0);
+        positionCarry[i] = 0;
+      }
+      LOG_DEBUGLN("G28 line detected");
+    } else if (isCommand(line, "G90") || isCommand(line, "G91")) { //absolute / relative positioning
+      relativeAxes = relativeExtrusion = isCommand(line, "G91");
+    } else if (isCommand(line, "M82") || isCommand(line, "M83")) { //absolute / relative extrusion
+      relativeExtrusion = isCommand(line, "M83");
+    } else if (isCommand(line, "G92")) { //set position
+      for (int i = 0; i < axisCount; i++) {
+        const char* value = strchr(line, axisLetters[i]);
+        if (value) {
+          axisOffset[i] = currentPosition(i) - toolOffset(i) - atof(value + 1);
+        }
       }
+    } else if (isCommand(line, "M84")) { //enable all steppers
+      flushMove(target);
+      target.println("M84");
+      LOG_DEBUGLN("M84 line detected");
+    } else if (isCommand(line, "M220") || isCommand(line, "M221") || isCommand(line, "M593")) { //feedrate / flow override, input shaping
+      flushMove(target);
+      target.println(line);
+      LOG_DEBUG(line);
+      LOG_DEBUGLN(" line detected");
+    } else if (line[0] == 'T') { //tool change
+      int tool = atoi(line + 1);
+      if (tool >= 0 && tool < toolCount) {
+        flushMove(target);
+        activeTool = tool;
+        positionCarry[E_AXIS] = 0;  // the carry belonged to the extruder of the previous tool
+        target.print('T');
+        target.println(tool);
+        LOG_DEBUG(line);
+        LOG_DEBUGLN(" line detected");
+      } else {
+        LOG_ERRORLN("unknown tool... ignoring line");
+      }
+    } else {
+      LOG_DEBUGLN("no matching start code... ignoring line");
     }
+  }
 
-    if (!isnan(parsedE)) {
-      stepsE = planner.calculateSteps(stepperE, stepperE.getCurrentPos(), parsedE);
-      stepperE.setCurrentPos(parsedE);
-      if (stepsE != 0) {
-        char temp[12];
-        sprintf(temp, "E%d", stepsE);
-        strcat(line, temp);
-        moved = true;
+  void translateG(const float parsed[axisCount], float parsedS, Print& target)
+  //Method for translating the G command line in gcode
+  //by converting the values to machine positions and merging them into the pending move,
+  //which is written to the translated file once the next move can not extend it
+  {
+    if (!isnan(parsedS)) feedrate = parsedS;
+
+    float targetPos[axisCount];
+    bool moved = false;
+    for (int i = 0; i < axisCount; i++) {
+      targetPos[i] = currentPosition(i);
+      if (isnan(parsed[i])) continue;  // Only move axes that were actually provided
+
+      // X/Y/Z are machine positions of the active nozzle, every tool has its own extruder
+      bool relative = (i == E_AXIS) ? relativeExtrusion : relativeAxes;
+      if (relative) {
+        // compensated sum: thousands of relative E moves would otherwise lose a step to float rounding
+        float distance = parsed[i] - positionCarry[i];
+        targetPos[i] += distance;
+        positionCarry[i] = (targetPos[i] - currentPosition(i)) - distance;
+      } else {
+        targetPos[i] = parsed[i] + axisOffset[i] + toolOffset(i);
+        positionCarry[i] = 0;
       }
+      if (targetPos[i] != currentPosition(i)) moved = true;
     }
+    if (!moved) return;
+    parsedMoves++;
 
-    if (!isnan(parsedS)) {
-      speedMicros = (1000000 / ((parsedS / 60) * stepperX.getStepsPerMM()));
-      char temp[12];
-      sprintf(temp, "S%d", speedMicros);
-      strcat(line, temp);
+    float deviation;
+    if (canMerge(targetPos, deviation)) {
+      mergedPoints[mergedCount][0] = moveEnd[X_AXIS];
+      mergedPoints[mergedCount][1] = moveEnd[Y_AXIS];
+      mergedCount++;
+      if (deviation > maxDeviation) maxDeviation = deviation;
+      for (int i = 0; i < axisCount; i++) {
+        moveEnd[i] = targetPos[i];
+      }
+      return;
     }
 
-    if (moved) {
-      target.println(line);
+    flushMove(target);
+    for (int i = 0; i < axisCount; i++) {
+      moveStart[i] = currentPosition(i);
+      moveEnd[i] = targetPos[i];
     }
+    moveFeedrate = feedrate;
+    mergedCount = 0;
+    movePending = true;
+  }
+
+  void flushPendingMove(Print& target) {
+    flushMove(target);
   }
 
-  void processGCODE(char* sourceFile, char* targetFile) {
+  // After an SD print: the motor positions followed the file, the host continues with the tool it
+  // ended with and the next move writes its S again because the file changed speedMicros
+  void continueAfterPrint() {
+    activeTool = planner.getTool();
+    writtenSpeedMicros = -1;
+  }
+
+  void processGCODE(const char* sourceFile, const char* targetFile, const char* indexFile, const char* sourceID) {
     // Step 1: Open the source file
     File source = SD.open(sourceFile, FILE_READ);
     if (!source) {
@@ -158,20 +404,57 @@ public:
       return;
     }
 
-    File target = SD.open(targetFile, FILE_WRITE);
-    if (!target) {
+    File cacheFile = SD.open(targetFile, FILE_WRITE);
+    if (!cacheFile) {
       Serial.print("Could not open target file: ");
       Serial.println(targetFile);
       source.close();
       return;
     }
+    // the cache is written in whole sectors instead of one println at a time
+    BufferedWriter target(cacheSectorBuffer, sizeof(cacheSectorBuffer));
+    target.begin(cacheFile, false);
 
+    if (!layerIndex.create(indexFile, sourceID)) {
+      Serial.print("Could not create layer index: ");
+      Serial.println(indexFile);
+    }
+
+    // the cache must not depend on what was translated before in this session,
+    // and the host session continues afterwards with its own modes and positions
+    SessionState session;
+    saveSession(session);
+    resetTranslation();
+    planner.resetPositions();
     while (source.available()) {
       parseGcodeLine(source, target);
+      receiveSerial();
     }
+    flushMove(target);
+    finishLayer();
+    layerIndex.close();
 
-    Serial.println("Translating done!");
+    Serial.print("Translating done! Layers: ");
+    Serial.println(layerCount);
+    Serial.print("Moves: ");
+    Serial.print(parsedMoves);
+    Serial.print(" -> ");
+    Serial.print(writtenMoves);
+    Serial.print(" (");
+    Serial.print(droppedMoves);
+    Serial.print(" below one step), max deviation: ");
+    Serial.print(maxDeviation, 4);
+    Serial.println(" mm");
+    Serial.print("Final position error (steps):");
+    for (int i = 0; i < axisCount; i++) {
+      StepperController& motor = planner.getMotor(i, activeTool);
+      Serial.print(" ");
+      Serial.print(axisLetters[i]);
+      Serial.print(motor.getCurrentPos() * motor.getStepsPerMM() - motor.getCurrentSteps(), 3);
+    }
+    Serial.println();
 
+    restoreSession(session);
     source.close();
     target.close();
   }
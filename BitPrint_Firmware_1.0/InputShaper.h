@@ -0,0 +1,209 @@
+//This class shapes the step stream of one motor (M593): every step from the planner is sent at one of
+//two or three impulse times (ZV, MZV or EI), picked so that over many steps the share of each impulse
+//matches its amplitude. The delayed steps wait in a small queue per impulse until the step timer reaches them.
+
+#ifndef INPUTSHAPER_H
+#define INPUTSHAPER_H
+
+#include <Arduino.h>
+#include "StepperController.h"
+#include "StepBatch.h"
+
+enum ShaperType {
+  SHAPER_ZV,
+  SHAPER_MZV,
+  SHAPER_EI,
+  SHAPER_TYPE_COUNT
+};
+
+struct ShapedStep {
+  uint32_t time;  // step clock in micros
+  bool dir;
+};
+
+class InputShaper {
+private:
+  static const int maxImpulses = 3;
+  static const int weightTotal = 64;  // amplitudes in 1/64
+
+  StepperController* motor;
+  StepBatch* batch;
+  uint8_t type;
+  float frequency;  // Hz, 0 = off
+  float damping;
+
+  uint8_t impulseCount;
+  uint16_t offsets[maxImpulses];  // micros after the planner step, offsets[0] is always 0
+  uint8_t weights[maxImpulses];
+  int16_t credit[maxImpulses];    // weighted round robin state
+
+  // One FIFO per delayed impulse, each is sorted by time because its offset is constant
+  ShapedStep queue[maxImpulses - 1][shaperQueueSize];
+  volatile uint8_t queueHead[maxImpulses - 1];
+  volatile uint8_t queueTail[maxImpulses - 1];
+  uint8_t lastDir;  // 2 until the direction pin has been written once
+  volatile uint16_t unshapedCount;  // steps sent unshaped because their FIFO was full
+
+  static uint8_t nextQueueIndex(uint8_t index) {
+    return (index + 1) % shaperQueueSize;
+  }
+
+  static bool reached(uint32_t time, uint32_t now) {
+    return (int32_t)(now - time) >= 0;
+  }
+
+  void pulse(bool dir) {
+    if (dir != lastDir) {
+      batch->beforeDirectionChange(*motor);
+      motor->setDirection(dir);
+      lastDir = dir;
+    }
+    batch->add(*motor);
+  }
+
+public:
+  InputShaper() : motor(0), batch(0), type(SHAPER_ZV), frequency(0), damping(0.1), impulseCount(1), lastDir(2), unshapedCount(0) {
+    offsets[0] = 0;
+    weights[0] = weightTotal;
+    for (int i = 0; i < maxImpulses; i++) credit[i] = 0;
+    for (int i = 0; i < maxImpulses - 1; i++) queueHead[i] = queueTail[i] = 0;
+  }
+
+  void attach(StepperController* m, StepBatch* b) {
+    motor = m;
+    batch = b;
+  }
+
+  // Recalculates the impulses, runs outside the step timer, only the final copy is done with interrupts off
+  void configure(uint8_t shaperType, float freq, float zeta) {
+    type = shaperType < SHAPER_TYPE_COUNT ? shaperType : (uint8_t)SHAPER_ZV;
+    frequency = freq;
+    damping = constrain(zeta, 0.0, 0.99);
+
+    float amplitude[maxImpulses] = { 1, 0, 0 };
+    float timing[maxImpulses] = { 0, 0, 0 };
+    uint8_t count = 1;
+    if (frequency > 0) {
+      float root = sqrt(1 - damping * damping);
+      // the last impulse comes 0.5 (ZV), 0.75 (MZV) or 1 (EI) damped periods after the step and has to fit
+      // the 16 bit offsets, with high damping that needs more than minShapingFrequency
+      float lastImpulse = type == SHAPER_ZV ? 0.5 : type == SHAPER_MZV ? 0.75 : 1.0;
+      float lowestFrequency = lastImpulse * 1000000.0 / (65535.0 * root);
+      if (frequency < lowestFrequency) frequency = lowestFrequency;
+      float K = exp(-damping * PI / root);
+      float period = 1000000.0 / (frequency * root);  // damped period in micros
+      if (type == SHAPER_ZV) {
+        count = 2;
+        amplitude[0] = 1; amplitude[1] = K;
+        timing[1] = 0.5 * period;
+      } else if (type == SHAPER_MZV) {
+        float K2 = exp(-0.75 * damping * PI / root);
+        float a1 = 1 - 1 / sqrt(2.0);
+        count = 3;
+        amplitude[0] = a1; amplitude[1] = (sqrt(2.0) - 1) * K2; amplitude[2] = a1 * K2 * K2;
+        timing[1] = 0.375 * period; timing[2] = 0.75 * period;
+      } else {
+        float vtol = 0.05;  // EI vibration tolerance
+        count = 3;
+        amplitude[0] = 0.25 * (1 + vtol); amplitude[1] = 0.5 * (1 - vtol) * K; amplitude[2] = amplitude[0] * K * K;
+        timing[1] = 0.5 * period; timing[2] = period;
+      }
+    }
+
+    float sum = 0;
+    for (int i = 0; i < count; i++) sum += amplitude[i];
+    uint8_t newWeights[maxImpulses];
+    uint16_t newOffsets[maxImpulses];
+    int assigned = 0;
+    for (int i = count - 1; i >= 0; i--) {
+      newWeights[i] = i == 0 ? weightTotal - assigned : round(amplitude[i] / sum * weightTotal);
+      newOffsets[i] = min(timing[i], 65535.0);
+      assigned += newWeights[i];
+    }
+
+    noInterrupts();
+    impulseCount = count;
+    for (int i = 0; i < count; i++) {
+      weights[i] = newWeights[i];
+      offsets[i] = newOffsets[i];
+      credit[i] = 0;
+    }
+    interrupts();
+  }
+
+  uint8_t getType() const {
+    return type;
+  }
+
+  float getFrequency() const {
+    return frequency;
+  }
+
+  float getDamping() const {
+    return damping;
+  }
+
+  // Step from the planner at step clock "now", sent now or queued for a later impulse
+  void step(uint32_t now, bool dir) {
+    uint8_t pick = 0;
+    for (uint8_t i = 0; i < impulseCount; i++) {
+      credit[i] += weights[i];
+      if (credit[i] > credit[pick]) pick = i;
+    }
+    credit[pick] -= weightTotal;
+
+    if (pick > 0) {
+      uint8_t q = pick - 1;
+      uint8_t next = nextQueueIndex(queueTail[q]);
+      if (next != queueHead[q]) {
+        queue[q][queueTail[q]].time = now + offsets[pick];
+        queue[q][queueTail[q]].dir = dir;
+        queueTail[q] = next;
+        return;
+      }
+      // queue full: better an unshaped step than a lost one
+      if (unshapedCount < 0xFFFF) unshapedCount++;
+    }
+    pulse(dir);
+  }
+
+  // Sends every queued step that is due
+  void emitDue(uint32_t now) {
+    for (uint8_t q = 0; q < maxImpulses - 1; q++) {
+      while (queueHead[q] != queueTail[q] && reached(queue[q][queueHead[q]].time, now)) {
+        pulse(queue[q][queueHead[q]].dir);
+        queueHead[q] = nextQueueIndex(queueHead[q]);
+      }
+    }
+  }
+
+  // Earliest queued step, false if nothing is queued
+  bool nextTime(uint32_t now, uint32_t& next) const {
+    bool found = false;
+    for (uint8_t q = 0; q < maxImpulses - 1; q++) {
+      if (queueHead[q] == queueTail[q]) continue;
+      uint32_t t = queue[q][queueHead[q]].time;
+      if (!found || (int32_t)(t - now) < (int32_t)(next - now)) next = t;
+      found = true;
+    }
+    return found;
+  }
+
+  // read and reset with interrupts off
+  uint16_t unshapedSteps() const {
+    return unshapedCount;
+  }
+
+  void resetStats() {
+    unshapedCount = 0;
+  }
+
+  bool idle() const {
+    for (uint8_t q = 0; q < maxImpulses - 1; q++) {
+      if (queueHead[q] != queueTail[q]) return false;
+    }
+    return true;
+  }
+};
+
+#endif
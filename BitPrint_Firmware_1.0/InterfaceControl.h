@@ -8,9 +8,21 @@
 
 class InterfaceControl {
   private:
+  MotionPlanner& planner;
 
   public:
+  InterfaceControl(MotionPlanner& mp) : planner(mp) {}
+
+  //knob turned while the feedrate item is selected, delta in percent
+  void changeFeedrate(int delta) {
+    planner.setFeedratePercent(planner.getFeedratePercent() + delta);
+  }
+
+  //knob turned while the flow item is selected, delta in percent
+  void changeFlow(int delta) {
+    planner.setFlowPercent(planner.getFlowPercent() + delta);
+  }
 
 };
 
-#endif
\ No newline at end of file
+#endif
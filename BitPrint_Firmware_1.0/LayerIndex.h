@@ -0,0 +1,79 @@
+//This class keeps a fixed size record for every layer next to the TXT cache (same base name, .IDX)
+//so a layer can be found with a single seek instead of reading the whole file again.
+//The file starts with the source ID line of the TXT it was written with, padded to sourceIDSize bytes.
+
+#ifndef LAYERINDEX_H
+#define LAYERINDEX_H
+
+#include <Arduino.h>
+#include <SD.h>
+#include "Config.h"
+
+struct LayerIndexEntry {
+  uint32_t sourceOffset;             // position of ;LAYER_CHANGE in the .gco file
+  uint32_t cacheOffset;              // position of the layer marker (L<n>) in the TXT file
+  float z;                           // layer height from the ;Z: comment
+  int32_t positionSteps[axisCount];  // machine position in steps of the active tool at the layer start
+  int16_t speedMicros;               // modal step delay at the layer start
+  int16_t tool;                      // active tool at the layer start
+};
+
+class LayerIndex {
+private:
+  File file;
+  int count;
+
+public:
+  LayerIndex() : count(0) {}
+
+  bool create(const char* fileName, const char* sourceID) {
+    SD.remove(fileName);  // FILE_WRITE appends, so start from an empty file
+    file = SD.open(fileName, FILE_WRITE);
+    count = 0;
+    if (!file) return false;
+    for (int i = 0; i < sourceIDSize; i++) {
+      file.write((uint8_t)(*sourceID ? *sourceID++ : 0));
+    }
+    return true;
+  }
+
+  void add(const LayerIndexEntry& entry) {
+    if (!file) return;
+    file.write((const uint8_t*)&entry, sizeof(entry));
+    count++;
+  }
+
+  bool open(const char* fileName) {
+    file = SD.open(fileName, FILE_READ);
+    count = file && file.size() >= sourceIDSize ? (file.size() - sourceIDSize) / sizeof(LayerIndexEntry) : 0;
+    return file;
+  }
+
+  // True if the index was written together with the TXT that has this source ID
+  bool belongsTo(const char* sourceID) {
+    if (!file || !file.seek(0)) return false;
+    for (int i = 0; i < sourceIDSize; i++) {
+      int c = file.read();
+      if (c != (uint8_t)*sourceID) return false;
+      if (c == 0) return true;
+      sourceID++;
+    }
+    return false;
+  }
+
+  bool read(int layer, LayerIndexEntry& entry) {
+    if (!file || layer < 0 || layer >= count) return false;
+    file.seek(sourceIDSize + (uint32_t)layer * sizeof(LayerIndexEntry));
+    return file.read((uint8_t*)&entry, sizeof(entry)) == sizeof(entry);
+  }
+
+  int layerCount() const {
+    return count;
+  }
+
+  void close() {
+    if (file) file.close();
+  }
+};
+
+#endif
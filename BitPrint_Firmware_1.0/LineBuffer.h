@@ -0,0 +1,56 @@
+//This file contains the helpers for working on text lines in fixed char buffers instead of String,
+//so reading G-code, TXT and serial lines never touches the heap
+
+#ifndef LINEBUFFER_H
+#define LINEBUFFER_H
+
+#include <Arduino.h>
+#include "Config.h"
+
+// Removes leading and trailing whitespace in place, returns the new length
+inline int trimLine(char* line) {
+  int start = 0;
+  while (isspace((unsigned char)line[start])) start++;
+  int length = strlen(line + start);
+  while (length > 0 && isspace((unsigned char)line[start + length - 1])) length--;
+  memmove(line, line + start, length);
+  line[length] = '\0';
+  return length;
+}
+
+// Reads one line from a file without the line ending and trims it, returns the length.
+// The part of a line that does not fit in the buffer is skipped.
+inline int readLine(Stream& source, char* line, int size) {
+  int length = 0;
+  int c;
+  while ((c = source.read()) != -1 && c != '\n') {
+    if (length < size - 1) line[length++] = c;
+  }
+  line[length] = '\0';
+  return trimLine(line);
+}
+
+inline bool lineStartsWith(const char* line, const char* prefix) {
+  return strncmp(line, prefix, strlen(prefix)) == 0;
+}
+
+// True if the first word of the line (up to the first space) is exactly "command"
+inline bool isCommand(const char* line, const char* command) {
+  int length = strlen(command);
+  return strncmp(line, command, length) == 0 && (line[length] == '\0' || line[length] == ' ');
+}
+
+// True if the file name ends in "." + extension, any case
+inline bool hasExtension(const char* fileName, const char* extension) {
+  const char* dot = strrchr(fileName, '.');
+  return dot && strcasecmp(dot + 1, extension) == 0;
+}
+
+// Copies the file name without its extension and appends a new one, "PART.GCO" -> "PART.TXT"
+inline void replaceExtension(char* target, int size, const char* fileName, const char* extension) {
+  const char* dot = strrchr(fileName, '.');
+  int baseLength = dot ? dot - fileName : strlen(fileName);
+  snprintf(target, size, "%.*s.%s", baseLength, fileName, extension);
+}
+
+#endif
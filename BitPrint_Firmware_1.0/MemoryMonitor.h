@@ -0,0 +1,74 @@
+//This class reports the free RAM between the heap and the stack. paintStack() fills the free RAM with a
+//pattern at startup; the bytes that still hold the pattern later show how deep the stack has ever grown.
+
+#ifndef MEMORYMONITOR_H
+#define MEMORYMONITOR_H
+
+#include <Arduino.h>
+#include "Config.h"
+
+#ifdef __AVR__
+extern uint8_t __heap_start;
+extern void* __brkval;
+#endif
+
+class MemoryMonitor {
+private:
+  static const uint8_t paintByte = 0xA5;
+
+#ifdef __AVR__
+  // top of the heap, the SD library still allocates its File handles there
+  static uint8_t* heapEnd() {
+    return __brkval ? (uint8_t*)__brkval : &__heap_start;
+  }
+#endif
+
+public:
+  // Call first in setup(), everything below the current stack frame is painted
+  static void paintStack() {
+#ifdef __AVR__
+    uint8_t marker;
+    for (uint8_t* p = heapEnd(); p < &marker - 16; p++) *p = paintByte;
+#endif
+  }
+
+  // Bytes between the heap and the stack right now, -1 where this can not be measured
+  static int freeStack() {
+#ifdef __AVR__
+    uint8_t marker;
+    return &marker - heapEnd();
+#else
+    return -1;
+#endif
+  }
+
+  // Bytes the stack has never used since paintStack(), -1 where this can not be measured
+  static int unusedStack() {
+#ifdef __AVR__
+    uint8_t marker;
+    uint8_t* p = heapEnd();
+    while (p < &marker && *p == paintByte) p++;
+    return p - heapEnd();
+#else
+    return -1;
+#endif
+  }
+
+  static void printReport() {
+    int unused = unusedStack();
+    if (unused < 0) {
+      Serial.println("Free stack: not measured on this build");
+      return;
+    }
+    Serial.print("Free stack: ");
+    Serial.print(freeStack());
+    Serial.print(" bytes, never used: ");
+    Serial.print(unused);
+    Serial.println(" bytes");
+    if (unused < minFreeStack) {
+      Serial.println("Warning: stack close to the heap, reduce the buffer sizes in Config.h");
+    }
+  }
+};
+
+#endif
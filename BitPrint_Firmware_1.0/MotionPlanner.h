@@ -3,92 +3,603 @@
 
 #include <Arduino.h>
 #include "StepperController.h"
+#include "Profiler.h"
+#include "InputShaper.h"
+#include "StepBatch.h"
 
 struct Axis {
-  StepperController& motor;
+  StepperController* motor;
   int steps;
   int err;
+  int8_t shaper;  // index into shapers, -1 for motors that are stepped directly
+  bool dir;
+};
+
+struct PlannerBlock {
+  int steps[axisCount];     // steps per logical axis as stored in the TXT file
+  int tool;                 // tool that was active when the move was queued
+  uint16_t nominalSpeedMicros;   // step delay at 100% feedrate
+  uint16_t slowdownSpeedMicros;  // minimum step delay while the queue is running low, 0 if not slowed down
+  uint16_t limitSpeedMicros;     // minimum step delay that keeps every axis below its maxStepRate
+  uint16_t speedMicros;          // step delay with the feedrate override applied
 };
 
 class MotionPlanner {
 private:
-  StepperController& stepperX;
-  StepperController& stepperY;
-  StepperController& stepperZ;
-  StepperController& stepperE;
+  StepperController** motors;  // motor table, axis and tool of each motor are in Config.h
 
-public:
-  MotionPlanner(StepperController& x, StepperController& y, StepperController& z, StepperController& e)
-    : stepperX(x), stepperY(y), stepperZ(z), stepperE(e) {}
+  // The queue is shared with the step timer: the main loop only moves blockTail, stepTick only moves blockHead
+  PlannerBlock blocks[plannerBufferSize];
+  volatile uint8_t blockHead;  // next block to execute
+  volatile uint8_t blockTail;  // next free slot
+  int queueTool;               // tool used for newly queued moves (T0 / T1)
+  int feedPercent;             // M220
+  int flowPercent;             // M221
+  long flowRemainder;          // E steps lost to flow scaling, carried to the next move
+
+  // Block currently executed by stepTick
+  volatile bool blockActive;
+  Axis axes[motorCount];
+  int activeCount;
+  int maxSteps;
+  int stepIndex;
+  int accelSteps;
+  uint16_t minSpeedMicros;  // fastest (smallest delay)
+  uint16_t maxSpeedMicros;  // slowest (start/end)
+  // Ramp position n as maxSpeedMicros - rampOffset = maxSpeedMicros - range * n / accelSteps,
+  // advanced by quotient and remainder so the step interrupt does not divide
+  uint16_t rampStep;
+  uint16_t rampRemainder;
+  uint16_t rampOffset;
+  int rampError;
+  bool decelerating;
+  int microstepFactor; // steps of the configured resolution per step of the active block (travelMicroSteps)
+
+  // Step clock in micros, advanced by every stepTick so delayed (shaped) steps can be scheduled
+  uint32_t stepClock;
+  uint32_t nextPlannerStep;
+  StepBatch stepBatch;     // steps of the current stepTick, sent together at its end
+  InputShaper shapers[2];  // X and Y
+  int8_t motorShaper[motorCount];
 
-  inline void moveXYZE(int stepsX, int stepsY, int stepsZ, int stepsE, int baseSpeedMicros) {
-    Axis axes[] = {
-      { stepperX, abs(stepsX), 0 },
-      { stepperY, abs(stepsY), 0 },
-      { stepperZ, abs(stepsZ), 0 },
-      { stepperE, abs(stepsE), 0 }
-    };
+  // Underrun statistics, only counted while a file or a host session is streamed into the queue
+  volatile bool streaming;
+  volatile bool waitingForHost;         // the host has not sent the next line yet
+  volatile uint16_t underrunCount;      // queue ran empty between two moves
+  volatile uint32_t starvedMicros;      // time spent waiting for the next move
+  volatile uint16_t hostUnderrunCount;  // the same while waiting for the host
+  volatile uint32_t hostWaitMicros;
+  uint16_t slowdownCount;           // moves slowed down because the queue was low
+  uint16_t rateLimitCount;          // moves slowed down to stay below maxStepRate
+  volatile uint16_t travelCount;    // moves run at travelMicroSteps
+  volatile uint16_t lateTickCount;  // step interrupts that took longer than the period they set
+
+  uint8_t nextBlockIndex(uint8_t index) const {
+    return (index + 1) % plannerBufferSize;
+  }
+
+  // Step delay with the feedrate override, factor > 1 for a block run at a coarser microstep resolution.
+  // Slow moves at a low feedrate are clamped to maxStepDelayMicros.
+  uint16_t scaledSpeedMicros(const PlannerBlock& block, int factor = 1) const {
+    long delayMicros = (long)block.nominalSpeedMicros * factor * 100 / feedPercent;
+    delayMicros = max((long)block.slowdownSpeedMicros * factor, delayMicros);
+    delayMicros = max((long)block.limitSpeedMicros, delayMicros);
+    return constrain(delayMicros, (long)minStepDelayMicros, (long)maxStepDelayMicros);
+  }
 
-    int axisSteps[] = { stepsX, stepsY, stepsZ, stepsE };
-    for (int i = 0; i < 4; i++) {
-      digitalWrite(axes[i].motor.getDirPin(), axisSteps[i] > 0);
+  // Ramp of the active block, called when it starts and when the feedrate override changes
+  void setActiveSpeed(const PlannerBlock& block) {
+    minSpeedMicros = microstepFactor > 1 ? scaledSpeedMicros(block, microstepFactor) : block.speedMicros;
+    maxSpeedMicros = minSpeedMicros + minSpeedMicros / 2;
+    uint16_t range = maxSpeedMicros - minSpeedMicros;
+    rampStep = range / accelSteps;
+    rampRemainder = range % accelSteps;
+    if (stepIndex < accelSteps) setRamp(stepIndex);
+    else if (decelerating) setRamp(maxSteps - stepIndex);
+  }
+
+  void setRamp(int n) {
+    uint32_t position = (uint32_t)(maxSpeedMicros - minSpeedMicros) * n;
+    rampOffset = n > 0 ? position / accelSteps : 0;
+    rampError = n > 0 ? position % accelSteps : 0;
+  }
+
+  void rampUp() {
+    rampOffset += rampStep;
+    rampError += rampRemainder;
+    if (rampError >= accelSteps) {
+      rampError -= accelSteps;
+      rampOffset++;
     }
+  }
+
+  void rampDown() {
+    rampOffset -= rampStep;
+    rampError -= rampRemainder;
+    if (rampError < 0) {
+      rampError += accelSteps;
+      rampOffset--;
+    }
+  }
+
+  int scaledExtruderSteps(int stepsE) {
+    long scaled = (long)stepsE * flowPercent + flowRemainder;
+    flowRemainder = scaled % 100;
+    return scaled / 100;
+  }
+
+  bool motorUsedByTool(int motor, int tool) const {
+    return motorTool[motor] == allTools || motorTool[motor] == tool;
+  }
+
+  int blockMaxSteps(const PlannerBlock& block) const {
+    int most = 0;
+    for (int i = 0; i < axisCount; i++) {
+      if (abs(block.steps[i]) > most) most = abs(block.steps[i]);
+    }
+    return most;
+  }
+
+  // Every axis steps at most once per step of the longest one, so the step delay needed to keep
+  // an axis below its maxStepRate shrinks with its share of the steps
+  uint16_t stepRateLimitMicros(const PlannerBlock& block) const {
+    long steps = blockMaxSteps(block);
+    long limit = 0;
+    for (int i = 0; i < axisCount; i++) {
+      long axisSteps = abs(block.steps[i]);
+      if (i == E_AXIS) axisSteps = axisSteps * flowPercent / 100;
+      if (axisSteps == 0) continue;
+      long minStepMicros = (1000000L + maxStepRate[i] - 1) / maxStepRate[i];
+      limit = max(limit, (minStepMicros * axisSteps + steps - 1) / steps);
+    }
+    return limit;
+  }
+
+  // Travel moves (X/Y only) that are held back by maxStepRate run at travelMicroSteps if every moving
+  // motor has microstep pins and sits on a step of the coarser resolution, returns the step factor
+  int travelFactor(const PlannerBlock& block) const {
+    const int factor = microSteps / travelMicroSteps;
+    if (factor <= 1 || block.steps[Z_AXIS] != 0 || block.steps[E_AXIS] != 0) return 1;
+    if (block.speedMicros > block.limitSpeedMicros) return 1;
+    for (int i = 0; i < motorCount; i++) {
+      int axisSteps = block.steps[motorAxis[i]];
+      if (axisSteps == 0 || !motorUsedByTool(i, block.tool)) continue;
+      if (!motors[i]->hasMicrostepPins() || axisSteps % factor != 0 || !motors[i]->alignedTo(travelMicroSteps)) return 1;
+    }
+    return factor;
+  }
+
+  // Sets the microstep resolution of the next block's motors, false while shaped steps of the previous
+  // block are still queued and the resolution has to change (they would be sent at the wrong step size)
+  bool prepareMicrosteps(const PlannerBlock& block) {
+    bool shapersIdle = shapers[0].idle() && shapers[1].idle();
+    microstepFactor = shapersIdle ? travelFactor(block) : 1;
+    int resolution = microSteps / microstepFactor;
+    for (int i = 0; i < motorCount; i++) {
+      if (block.steps[motorAxis[i]] == 0 || !motorUsedByTool(i, block.tool)) continue;
+      if (motors[i]->getMicrosteps() == resolution) continue;
+      if (!shapersIdle) return false;
+      motors[i]->setMicrosteps(resolution);
+    }
+    if (microstepFactor > 1) travelCount++;
+    return true;
+  }
 
-    int maxSteps = 0;
-    for (int i = 0; i < 4; i++) {
-      if (axes[i].steps > maxSteps) maxSteps = axes[i].steps;
+  // Short moves with few moves queued would drain the queue faster than the SD card and parser
+  // can refill it, so they are stretched towards minSegmentMicros, more the emptier the queue is.
+  // Like Marlin only with at least two moves queued, which caps the stretch at minSegmentMicros.
+  uint16_t slowdownSpeedMicros(const PlannerBlock& block, int queued) {
+    if (queued < 2 || queued >= slowdownQueueDepth) return 0;
+    long steps = blockMaxSteps(block);
+    if (steps == 0) return 0;
+    long segmentMicros = steps * scaledSpeedMicros(block);
+    if (segmentMicros >= minSegmentMicros) return 0;
+    segmentMicros += 2 * (minSegmentMicros - segmentMicros) / queued;
+    slowdownCount++;
+    return segmentMicros / steps;
+  }
+
+  // Loads the block at blockHead into the step state, called from stepTick
+  void startBlock() {
+    PlannerBlock& block = blocks[blockHead];
+    if (flowPercent != 100) block.steps[E_AXIS] = scaledExtruderSteps(block.steps[E_AXIS]);
+
+    // Collect only the motors that move in this block (both Z motors follow the Z axis)
+    activeCount = 0;
+    maxSteps = 0;
+    for (int i = 0; i < motorCount; i++) {
+      int axisSteps = block.steps[motorAxis[i]];
+      if (axisSteps == 0 || !motorUsedByTool(i, block.tool)) continue;
+#if ADAPTIVE_MICROSTEPPING
+      axisSteps /= microstepFactor;
+      motors[i]->addDriverSteps(axisSteps);
+#endif
+      axes[activeCount].dir = axisSteps > 0;
+      axes[activeCount].shaper = INPUT_SHAPING_ENABLED ? motorShaper[i] : -1;
+      // shaped motors set their direction per step, older steps of them may still be queued
+      if (axes[activeCount].shaper < 0) motors[i]->setDirection(axisSteps > 0);
+      axes[activeCount].motor = motors[i];
+      axes[activeCount].steps = abs(axisSteps);
+      if (axes[activeCount].steps > maxSteps) maxSteps = axes[activeCount].steps;
+      activeCount++;
+    }
+
+    for (int i = 0; i < activeCount; i++) {
       axes[i].err = maxSteps / 2;
     }
 
     // Acceleration profile
-    int accelSteps = max(5, maxSteps / 10);      // accelerate and decelerate over 25% each
-    int minSpeedMicros = baseSpeedMicros;        // fastest (smallest delay)
-    int maxSpeedMicros = baseSpeedMicros * 1.5;  // slowest (start/end)
-
-    for (int i = 0; i < maxSteps; i++) {
-      // Compute current delay based on phase of motion
-      int currentSpeedMicros = minSpeedMicros;
-
-      if (i < accelSteps) {
-        // Accelerating
-        float t = (float)i / accelSteps;
-        currentSpeedMicros = maxSpeedMicros - (maxSpeedMicros - minSpeedMicros) * t;
-      } else if (i > maxSteps - accelSteps) {
-        // Decelerating
-        float t = (float)(maxSteps - i) / accelSteps;
-        currentSpeedMicros = maxSpeedMicros - (maxSpeedMicros - minSpeedMicros) * t;
+    accelSteps = max(5, maxSteps / 10);
+    stepIndex = 0;
+    decelerating = false;
+    setActiveSpeed(block);
+    blockActive = true;
+  }
+
+  void finishBlock() {
+    blockActive = false;
+    blockHead = nextBlockIndex(blockHead);
+    if (streaming && queueEmpty()) {
+      if (waitingForHost) hostUnderrunCount++;
+      else underrunCount++;
+    }
+  }
+
+public:
+  MotionPlanner(StepperController** motorTable)
+    : motors(motorTable), blockHead(0), blockTail(0), queueTool(0),
+      feedPercent(100), flowPercent(100), flowRemainder(0), blockActive(false), microstepFactor(1),
+      stepClock(0), nextPlannerStep(0),
+      streaming(false), waitingForHost(false), underrunCount(0), starvedMicros(0), hostUnderrunCount(0),
+      hostWaitMicros(0), slowdownCount(0), rateLimitCount(0), travelCount(0),
+      lateTickCount(0) {
+    for (int i = 0; i < motorCount; i++) {
+      motorShaper[i] = -1;
+      if (motorAxis[i] == X_AXIS || motorAxis[i] == Y_AXIS) {
+        motorShaper[i] = motorAxis[i] == X_AXIS ? 0 : 1;
+        shapers[motorShaper[i]].attach(motors[i], &stepBatch);
+      }
+    }
+  }
+
+  // Starts the step timer, Timer1 in CTC mode with prescaler 64 (4us per tick)
+  void begin() {
+    configureShaper(0, SHAPER_ZV, shapingFrequencyX, shapingDamping);
+    configureShaper(1, SHAPER_ZV, shapingFrequencyY, shapingDamping);
+#ifdef __AVR__
+    noInterrupts();
+    TCCR1A = 0;
+    TCCR1B = (1 << WGM12) | (1 << CS11) | (1 << CS10);
+    TCNT1 = 0;
+    OCR1A = idleTickMicros / 4 - 1;
+    TIMSK1 |= (1 << OCIE1A);
+    interrupts();
+#endif
+  }
+
+  // Called from the step timer interrupt: does the planner step and/or the shaped steps that are due
+  // and returns the time in micros until it has to be called again
+  unsigned int stepTick() {
+    PROFILE_SCOPE(ZONE_STEP);
+    uint32_t now = stepClock;
+    if ((int32_t)(now - nextPlannerStep) >= 0) {
+      nextPlannerStep = now + plannerStep() / 4 * 4;  // the timer counts 4us ticks
+    }
+
+    uint32_t next = nextPlannerStep;
+#if INPUT_SHAPING_ENABLED
+    for (int i = 0; i < 2; i++) {
+      shapers[i].emitDue(now);
+      uint32_t shaped;
+      if (shapers[i].nextTime(now, shaped) && (int32_t)(shaped - next) < 0) next = shaped;
+    }
+#endif
+    stepBatch.send();
+
+    // rounded up to whole timer ticks: the step clock advances by what the timer really waits
+    // and a shaped step is never sent before its time
+    uint32_t interval = (max((uint32_t)minStepDelayMicros, next - now) + 3) / 4 * 4;
+    stepClock += interval;
+    return interval;
+  }
+
+  // One Bresenham step of the active block, returns the delay until the next one
+  unsigned int plannerStep() {
+    if (!blockActive) {
+      if (queueEmpty()) {
+        if (streaming && waitingForHost) hostWaitMicros += idleTickMicros;
+        else if (streaming) starvedMicros += idleTickMicros;
+        return idleTickMicros;
+      }
+#if ADAPTIVE_MICROSTEPPING
+      if (!prepareMicrosteps(blocks[blockHead])) return idleTickMicros;
+#endif
+      startBlock();
+      if (maxSteps == 0) {
+        finishBlock();
+        return idleTickMicros;
       }
+    }
+
+    // Compute current delay based on phase of motion
+    unsigned int currentSpeedMicros = minSpeedMicros;
+    if (stepIndex < accelSteps) {
+      // Accelerating
+      currentSpeedMicros = maxSpeedMicros - rampOffset;
+      rampUp();
+    } else if (stepIndex > maxSteps - accelSteps) {
+      // Decelerating, the ramp is placed once at its first step and then runs backwards
+      if (!decelerating) {
+        decelerating = true;
+        setRamp(maxSteps - stepIndex);
+      }
+      currentSpeedMicros = maxSpeedMicros - rampOffset;
+      rampDown();
+    }
+
+    // Step all moving axes using Bresenham
+    for (int j = 0; j < activeCount; j++) {
+      axes[j].err -= axes[j].steps;
+      if (axes[j].err < 0) {
+        if (axes[j].shaper >= 0) shapers[axes[j].shaper].step(stepClock, axes[j].dir);
+        else stepBatch.add(*axes[j].motor);
+        axes[j].err += maxSteps;
+      }
+    }
+
+    stepIndex++;
+    if (stepIndex >= maxSteps) finishBlock();
+    return currentSpeedMicros;
+  }
+
+  // M593, axis 0 = X, 1 = Y
+  void configureShaper(int axis, uint8_t type, float frequency, float damping) {
+    if (frequency > 0 && frequency < minShapingFrequency) frequency = minShapingFrequency;
+    shapers[axis].configure(type, frequency, damping);
+    if (shapers[axis].getFrequency() > frequency) {
+      Serial.print("Shaper frequency raised to ");
+      Serial.print(shapers[axis].getFrequency());
+      Serial.println(" Hz, the impulses of this damping would not fit 16 bit offsets");
+    }
+  }
+
+  uint8_t getShaperType(int axis) const {
+    return shapers[axis].getType();
+  }
+
+  float getShaperFrequency(int axis) const {
+    return shapers[axis].getFrequency();
+  }
+
+  float getShaperDamping(int axis) const {
+    return shapers[axis].getDamping();
+  }
+
+  void printShaper(int axis) {
+    static const char* const typeNames[SHAPER_TYPE_COUNT] = { "ZV", "MZV", "EI" };
+    Serial.print(axis == 0 ? "X" : "Y");
+    Serial.print(" shaper: ");
+    Serial.print(typeNames[shapers[axis].getType()]);
+    Serial.print(" F");
+    Serial.print(shapers[axis].getFrequency());
+    Serial.print(" D");
+    Serial.println(shapers[axis].getDamping());
+  }
+
+  // Returns the first motor driving the given axis for the given tool (the primary motor for dual Z)
+  StepperController& getMotor(int axis, int tool) const {
+    for (int i = 0; i < motorCount; i++) {
+      if (motorAxis[i] == axis && motorUsedByTool(i, tool)) return *motors[i];
+    }
+    return *motors[0];
+  }
+
+  bool queueFull() const {
+    return nextBlockIndex(blockTail) == blockHead;
+  }
 
-      // Step all axes using Bresenham
-      for (int j = 0; j < 4; j++) {
-        axes[j].err -= axes[j].steps;
-        if (axes[j].err < 0) {
-          axes[j].motor.pulseStepper(currentSpeedMicros);
-          axes[j].err += maxSteps;
-        }
+  bool queueEmpty() const {
+    return blockHead == blockTail;
+  }
+
+  // Number of moves waiting in the queue, including the one being stepped
+  int queuedBlocks() const {
+    return (blockTail + plannerBufferSize - blockHead) % plannerBufferSize;
+  }
+
+  bool idle() const {
+    return queueEmpty() && !blockActive && shapers[0].idle() && shapers[1].idle();
+  }
+
+  // Tool changes only affect moves queued after them
+  void selectTool(int tool) {
+    queueTool = constrain(tool, 0, toolCount - 1);
+  }
+
+  int getTool() const {
+    return queueTool;
+  }
+
+  // Adds a move to the planner queue, the caller has to make sure the queue is not full
+  void queueMove(const int steps[axisCount], int nominalSpeedMicros) {
+    PROFILE_SCOPE(ZONE_PLANNER);
+    PlannerBlock& block = blocks[blockTail];
+    for (int i = 0; i < axisCount; i++) {
+      block.steps[i] = steps[i];
+    }
+    block.tool = queueTool;
+    block.nominalSpeedMicros = constrain(nominalSpeedMicros, 0, maxStepDelayMicros);
+    block.slowdownSpeedMicros = 0;
+    block.limitSpeedMicros = 0;
+    if (streaming) block.slowdownSpeedMicros = slowdownSpeedMicros(block, queuedBlocks());
+    uint16_t unlimitedSpeedMicros = scaledSpeedMicros(block);
+    block.limitSpeedMicros = stepRateLimitMicros(block);
+    block.speedMicros = scaledSpeedMicros(block);
+    if (block.speedMicros > unlimitedSpeedMicros) rateLimitCount++;
+
+    noInterrupts();  // also keeps the compiler from publishing the block before it is written
+    blockTail = nextBlockIndex(blockTail);
+    interrupts();
+  }
+
+  void setFeedratePercent(int percent) {
+    feedPercent = constrain(percent, minOverridePercent, maxOverridePercent);
+    // recalculate every queued block so the new feedrate applies from the next move on
+    for (uint8_t i = blockHead; i != blockTail; i = nextBlockIndex(i)) {
+      uint16_t speed = scaledSpeedMicros(blocks[i]);
+      noInterrupts();  // speedMicros is read by the step timer when a block starts
+      blocks[i].speedMicros = speed;
+      interrupts();
+    }
+    // and the move being stepped, so a long move does not keep the old speed until it ends
+    noInterrupts();
+    if (blockActive) setActiveSpeed(blocks[blockHead]);
+    interrupts();
+  }
+
+  void setFlowPercent(int percent) {
+    noInterrupts();
+    flowPercent = constrain(percent, minOverridePercent, maxOverridePercent);
+    flowRemainder = 0;
+    interrupts();
+    // the E step rate of the waiting blocks changes with the flow, their maxStepRate limit has to follow
+    for (uint8_t i = blockHead; i != blockTail; i = nextBlockIndex(i)) {
+      uint16_t limit = stepRateLimitMicros(blocks[i]);
+      noInterrupts();  // a block that has started meanwhile has its E steps scaled already, it keeps its speed
+      if (i != blockHead || !blockActive) {
+        blocks[i].limitSpeedMicros = limit;
+        blocks[i].speedMicros = scaledSpeedMicros(blocks[i]);
       }
+      interrupts();
     }
   }
 
-  inline int calculateSteps(StepperController& motor, float currentPos, float targetPos) {
-    float disMM = abs(currentPos - targetPos);
-    int steps = disMM * motor.getStepsPerMM();
-    if (targetPos < currentPos) steps = -steps;
-    return steps;
+  int getFeedratePercent() const {
+    return feedPercent;
+  }
+
+  int getFlowPercent() const {
+    return flowPercent;
+  }
+
+  // While streaming, an empty queue counts as an underrun and short moves are slowed down
+  void setStreaming(bool enabled) {
+    streaming = enabled;
+    waitingForHost = false;
+  }
+
+  bool isStreaming() const {
+    return streaming;
+  }
+
+  // Underruns and starved time while the host has not sent the next line are counted apart,
+  // the firmware can not make up for a slow host or link
+  void setWaitingForHost(bool waiting) {
+    waitingForHost = waiting;
+  }
+
+  void resetQueueStats() {
+    noInterrupts();
+    underrunCount = 0;
+    starvedMicros = 0;
+    hostUnderrunCount = 0;
+    hostWaitMicros = 0;
+    slowdownCount = 0;
+    rateLimitCount = 0;
+    travelCount = 0;
+    lateTickCount = 0;
+    shapers[0].resetStats();
+    shapers[1].resetStats();
+    interrupts();
+  }
+
+  void printQueueStats() {
+    noInterrupts();
+    uint16_t underruns = underrunCount;
+    uint32_t starved = starvedMicros;
+    uint16_t hostUnderruns = hostUnderrunCount;
+    uint32_t hostWait = hostWaitMicros;
+    uint16_t travels = travelCount;
+    uint16_t lateTicks = lateTickCount;
+    uint32_t unshaped = (uint32_t)shapers[0].unshapedSteps() + shapers[1].unshapedSteps();
+    interrupts();
+    Serial.print("Queue underruns: ");
+    Serial.print(underruns);
+    Serial.print(", starved ms: ");
+    Serial.print(starved / 1000);
+    Serial.print(", host underruns: ");
+    Serial.print(hostUnderruns);
+    Serial.print(", waiting for host ms: ");
+    Serial.print(hostWait / 1000);
+    Serial.print(", slowed moves: ");
+    Serial.print(slowdownCount);
+    Serial.print(", rate limited moves: ");
+    Serial.print(rateLimitCount);
+    Serial.print(", travel microstep moves: ");
+    Serial.print(travels);
+    Serial.print(", late step ticks: ");
+    Serial.print(lateTicks);
+    Serial.print(", unshaped steps: ");
+    Serial.println(unshaped);
+  }
+
+  // Called from the step timer interrupt when it ran past the period stepTick asked for
+  void countLateTick() {
+    lateTickCount++;
+  }
+
+  // Steps from the motor's machine position to targetPos, the target is converted as an
+  // absolute position so rounding never adds up over many moves
+  inline long calculateSteps(StepperController& motor, float targetPos) {
+    return lround(targetPos * motor.getStepsPerMM()) - motor.getCurrentSteps();
   }
 
+  // Homing steps the motors directly, wait until idle() first (Executor::waitForMotion)
   void homeAllAxes() {
-    stepperX.home();
-    stepperY.home();
-    stepperZ.home();
+    // every axis except the extruders, both Z motors together so each squares against its own switch
+    for (int axis = 0; axis < axisCount; axis++) {
+      if (axis == E_AXIS) continue;
+      StepperController* group[motorCount];
+      int count = 0;
+      for (int i = 0; i < motorCount; i++) {
+        if (motorAxis[i] == axis) group[count++] = motors[i];
+      }
+      StepperController::home(group, count);
+    }
+  }
+
+  // Every motor back to 0, a file is always translated from the same start position
+  void resetPositions() {
+    for (int i = 0; i < motorCount; i++) {
+      motors[i]->setCurrentPos(0);
+    }
+  }
+
+  // Positions of every motor, the parser keeps the host session's across the translation of a file
+  void getPositions(float positions[motorCount]) const {
+    for (int i = 0; i < motorCount; i++) {
+      positions[i] = motors[i]->getCurrentPos();
+    }
+  }
+
+  void setPositions(const float positions[motorCount]) {
+    for (int i = 0; i < motorCount; i++) {
+      motors[i]->setCurrentPos(positions[i]);
+    }
+  }
+
+  // Follows a move of a TXT file with the motor positions, those moves were translated earlier
+  void addToPositions(const int steps[axisCount]) {
+    for (int i = 0; i < motorCount; i++) {
+      if (motorUsedByTool(i, queueTool)) motors[i]->addSteps(steps[motorAxis[i]]);
+    }
   }
 
   void enableAllAxes() {
-    stepperX.enable();
-    stepperY.enable();
-    stepperZ.enable();
-    stepperE.enable();
+    for (int i = 0; i < motorCount; i++) {
+      motors[i]->enable();
+    }
   }
 };
 
-#endif
\ No newline at end of file
+#endif
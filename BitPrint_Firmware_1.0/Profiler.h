@@ -0,0 +1,196 @@
+//This file contains the compile-time diagnostics: levelled logging, scope timers for the hot paths
+//and a RAM trace buffer that is drained to serial in small pieces between moves
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <Arduino.h>
+#include "Config.h"
+
+// Levelled logging, everything above LOG_LEVEL compiles out
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_INFO 2
+#define LOG_LEVEL_DEBUG 3
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(x) Serial.print(x)
+#define LOG_ERRORLN(x) Serial.println(x)
+#else
+#define LOG_ERROR(x)
+#define LOG_ERRORLN(x)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(x) Serial.print(x)
+#define LOG_INFOLN(x) Serial.println(x)
+#else
+#define LOG_INFO(x)
+#define LOG_INFOLN(x)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(x) Serial.print(x)
+#define LOG_DEBUGLN(x) Serial.println(x)
+#else
+#define LOG_DEBUG(x)
+#define LOG_DEBUGLN(x)
+#endif
+
+enum ProfileZone {
+  ZONE_PARSER,   // one G-code line parsed and translated
+  ZONE_PLANNER,  // one move added to the planner queue
+  ZONE_SD_READ,  // one line read from the SD card
+  ZONE_STEP,     // one step timer interrupt
+  ZONE_COUNT
+};
+
+struct ProfileStats {
+  uint32_t count;
+  uint32_t total;  // micros
+  uint16_t max;    // micros
+};
+
+struct TraceEvent {
+  uint32_t start;     // micros
+  uint16_t duration;  // micros, saturated
+  uint8_t zone;
+  uint8_t arg;
+};
+
+class Profiler {
+private:
+  ProfileStats stats[ZONE_COUNT];
+  TraceEvent events[traceBufferSize];
+  // eventHead is only moved by record() (with interrupts off, it also runs in the step interrupt),
+  // eventTail only by service(), both fit in one byte
+  volatile uint8_t eventHead;
+  volatile uint8_t eventTail;
+  uint16_t droppedEvents;
+  bool dumping;
+
+  static uint8_t nextEventIndex(uint8_t index) {
+    return (index + 1) % traceBufferSize;
+  }
+
+public:
+  Profiler() : eventHead(0), eventTail(0), droppedEvents(0), dumping(false) {
+    reset();
+  }
+
+  // AVR has no cycle counter, micros() has a 4us resolution on a 16MHz Mega
+  static uint32_t now() {
+    return micros();
+  }
+
+  void reset() {
+    for (int i = 0; i < ZONE_COUNT; i++) {
+      stats[i].count = 0;
+      stats[i].total = 0;
+      stats[i].max = 0;
+    }
+    droppedEvents = 0;
+  }
+
+  void record(uint8_t zone, uint32_t start, uint8_t arg) {
+    uint32_t elapsed = now() - start;
+    uint16_t duration = elapsed > 0xFFFF ? 0xFFFF : elapsed;
+
+    ProfileStats& s = stats[zone];
+    s.count++;
+    s.total += elapsed;
+    if (duration > s.max) s.max = duration;
+
+    uint8_t next = nextEventIndex(eventHead);
+    if (next == eventTail) {
+      droppedEvents++;  // never block the hot path, the trace is best effort
+      return;
+    }
+    TraceEvent& e = events[eventHead];
+    e.start = start;
+    e.duration = duration;
+    e.zone = zone;
+    e.arg = arg;
+    eventHead = next;
+  }
+
+  // Interrupt-safe wrapper for record(), restores the previous interrupt state
+  void recordAtomic(uint8_t zone, uint32_t start, uint8_t arg) {
+#ifdef __AVR__
+    uint8_t oldSREG = SREG;
+    cli();
+    record(zone, start, arg);
+    SREG = oldSREG;
+#else
+    record(zone, start, arg);
+#endif
+  }
+
+  // Prints the per-zone summary and starts draining the trace buffer,
+  // the buffer holds the first events recorded since the previous dump
+  void startDump() {
+    static const char* const zoneNames[ZONE_COUNT] = { "parser", "planner", "sd", "step" };
+    Serial.println("zone count total_us max_us");
+    for (int i = 0; i < ZONE_COUNT; i++) {
+      Serial.print(zoneNames[i]);
+      Serial.print(" ");
+      Serial.print(stats[i].count);
+      Serial.print(" ");
+      Serial.print(stats[i].total);
+      Serial.print(" ");
+      Serial.println(stats[i].max);
+    }
+    Serial.print("dropped ");
+    Serial.println(droppedEvents);
+    dumping = true;
+  }
+
+  // Called between moves, only writes what fits in the serial TX buffer so it never blocks
+  void service() {
+    while (dumping && Serial.availableForWrite() >= 24) {
+      if (eventTail == eventHead) {
+        Serial.println("T end");
+        dumping = false;
+        return;
+      }
+      const TraceEvent& e = events[eventTail];
+      Serial.print("T ");
+      Serial.print(e.zone);
+      Serial.print(" ");
+      Serial.print(e.start);
+      Serial.print(" ");
+      Serial.print(e.duration);
+      Serial.print(" ");
+      Serial.println(e.arg);
+      eventTail = nextEventIndex(eventTail);
+    }
+  }
+};
+
+#if PROFILING_ENABLED
+Profiler profiler;
+
+// Times the rest of the enclosing scope
+class ProfileScope {
+private:
+  uint8_t zone;
+  uint8_t arg;
+  uint32_t start;
+
+public:
+  ProfileScope(uint8_t z, uint8_t a = 0) : zone(z), arg(a), start(Profiler::now()) {}
+  ~ProfileScope() {
+    profiler.recordAtomic(zone, start, arg);
+  }
+};
+
+#define PROFILE_SCOPE(zone) ProfileScope profileScope_(zone)
+#define PROFILE_DUMP() profiler.startDump()
+#define PROFILE_SERVICE() profiler.service()
+#else
+#define PROFILE_SCOPE(zone)
+#define PROFILE_DUMP() Serial.println("Profiling disabled, set PROFILING_ENABLED in Config.h")
+#define PROFILE_SERVICE()
+#endif
+
+#endif
@@ -0,0 +1,103 @@
+//This class lets a host (Pronterface, OctoPrint, ...) send G-code over serial. Every received line goes
+//through the same GcodeParser translation as an SD file and the TXT records it produces are executed
+//right away instead of being written to the card. A line that is only a number starts the SD file with
+//that number from the list printed at startup.
+
+#ifndef SERIALHOST_H
+#define SERIALHOST_H
+
+#include <Arduino.h>
+#include "Config.h"
+#include "LineBuffer.h"
+#include "SerialReceiver.h"
+#include "GcodeParser.h"
+#include "Executor.h"
+#include "FileManager.h"
+
+// Print target for the parser that hands every finished record to the executor
+class RecordWriter : public Print {
+private:
+  Executor& executor;
+  char record[lineBufferSize];
+  int length;
+
+public:
+  RecordWriter(Executor& e) : executor(e), length(0) {}
+
+  size_t write(uint8_t c) override {
+    if (c == '\n') {
+      record[length] = '\0';
+      length = 0;
+      if (trimLine(record) > 0) executor.executeRecord(record);
+    } else if (c != '\r' && length < lineBufferSize - 1) {
+      record[length++] = c;
+    }
+    return 1;
+  }
+  using Print::write;
+};
+
+class SerialHost {
+private:
+  SerialReceiver& receiver;
+  GcodeParser& parser;
+  FileManager& fileManager;
+  MotionPlanner& planner;
+  RecordWriter records;
+  unsigned long lastLineMillis;
+
+  static bool isNumber(const char* line) {
+    if (!*line) return false;
+    while (isdigit((unsigned char)*line)) line++;
+    return *line == '\0';
+  }
+
+public:
+  SerialHost(SerialReceiver& sr, GcodeParser& p, FileManager& fm, MotionPlanner& mp)
+    : receiver(sr), parser(p), fileManager(fm), planner(mp), records(fm.getExecutor()), lastLineMillis(0) {}
+
+  void begin() {
+    Serial.println("Type the number of the file you want to print, or send G-code:");
+  }
+
+  // Called from loop(), handles at most one received line
+  void poll() {
+    Executor& executor = fileManager.getExecutor();
+    executor.pollSerial();
+    if (!receiver.available()) {
+      // nothing to merge with, the last move must not wait for the next line
+      parser.flushPendingMove(records);
+      planner.setWaitingForHost(true);
+      // the session streams until M400, a file or a pause of the host, an empty queue after that is expected
+      if (millis() - lastLineMillis >= hostIdleMillis) planner.setStreaming(false);
+      return;
+    }
+    planner.setWaitingForHost(false);
+
+    char* line = receiver.line();
+    if (isNumber(line)) {
+      int number = atoi(line);
+      receiver.next();
+      parser.flushPendingMove(records);
+      planner.setStreaming(false);
+      executor.waitForMotion();
+      fileManager.selectFile(number);
+      parser.continueAfterPrint();
+      planner.resetQueueStats();
+      return;
+    }
+
+    if (isCommand(line, "M400")) {  // wait for the moves to finish
+      parser.flushPendingMove(records);
+      planner.setStreaming(false);  // the queue runs empty on purpose
+      executor.waitForMotion();
+    } else if (!executor.handleOverrideCommand(line)) {
+      planner.setStreaming(true);
+      parser.translateLine(line, records);
+      lastLineMillis = millis();
+    }
+    receiver.next();
+  }
+};
+
+#endif
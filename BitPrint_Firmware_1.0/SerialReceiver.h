@@ -0,0 +1,158 @@
+//This class collects serial input into a small queue of complete lines so a host can keep several
+//commands in flight. Lines with a line number (N123 ... *checksum) are checked and a resend is requested
+//for a wrong number or checksum. "ok" is sent once a line has been taken out of the queue, so a host that
+//keeps at most hostLineCount lines without ok never sends more than the queue can store.
+
+#ifndef SERIALRECEIVER_H
+#define SERIALRECEIVER_H
+
+#include <Arduino.h>
+#include "Config.h"
+#include "LineBuffer.h"
+#include "MotionPlanner.h"
+
+class SerialReceiver {
+private:
+  MotionPlanner& planner;
+  char lines[hostLineCount][lineBufferSize];
+  uint8_t lineHead;     // next line to process
+  uint8_t lineTail;     // slot the next received line is written to
+  uint8_t queued;
+  int receiveLength;    // bytes of the line being received, in lines[lineTail]
+  bool overflow;        // line longer than lineBufferSize, cut off
+  long lastLineNumber;  // last accepted N
+  bool resendPending;   // numbered lines are ignored until the requested one arrives
+
+  static uint8_t nextLineIndex(uint8_t index) {
+    return (index + 1) % hostLineCount;
+  }
+
+  // ok N<last line> P<free planner slots> B<free line slots> like Marlin's ADVANCED_OK
+  void sendOk() {
+    Serial.print("ok N");
+    Serial.print(lastLineNumber);
+    Serial.print(" P");
+    Serial.print(plannerBufferSize - 1 - planner.queuedBlocks());
+    Serial.print(" B");
+    Serial.println(hostLineCount - queued);
+  }
+
+  void requestResend(const char* error) {
+    Serial.print("Error:");
+    Serial.print(error);
+    Serial.print(", Last Line: ");
+    Serial.println(lastLineNumber);
+    Serial.print("Resend: ");
+    Serial.println(lastLineNumber + 1);
+    sendOk();
+    resendPending = true;
+  }
+
+  // Checks line number and checksum and strips them, false if the line must not be queued
+  bool acceptLine(char* line) {
+    if (line[0] != 'N') return true;
+
+    char* star = strrchr(line, '*');
+    if (!star) {
+      requestResend("No Checksum with line number");
+      return false;
+    }
+    uint8_t checksum = 0;
+    for (char* c = line; c < star; c++) checksum ^= *c;
+    long number = atol(line + 1);
+
+    if (number != lastLineNumber + 1 && !strstr(line, "M110")) {
+      // after a resend request the host replays every line after it, those only get their ok
+      if (resendPending) sendOk();
+      else requestResend("Line Number is not Last Line Number+1");
+      return false;
+    }
+    if (checksum != atoi(star + 1)) {
+      requestResend("checksum mismatch");
+      return false;
+    }
+
+    resendPending = false;
+    lastLineNumber = number;
+    *star = '\0';
+    char* command = line + 1;
+    while (isdigit((unsigned char)*command)) command++;
+    memmove(line, command, strlen(command) + 1);
+    trimLine(line);
+    return true;
+  }
+
+  void finishLine() {
+    char* line = lines[lineTail];
+    line[receiveLength] = '\0';
+    receiveLength = 0;
+    if (overflow) {
+      overflow = false;
+      requestResend("Line too long");
+      return;
+    }
+    if (trimLine(line) == 0) return;
+    if (!acceptLine(line)) return;
+
+    // M110 N<n>: the host sets the line number it counts from
+    if (lineStartsWith(line, "M110")) {
+      const char* value = strchr(line, 'N');
+      if (value) lastLineNumber = atol(value + 1);
+      resendPending = false;
+      sendOk();
+      return;
+    }
+
+    lineTail = nextLineIndex(lineTail);
+    queued++;
+  }
+
+public:
+  SerialReceiver(MotionPlanner& mp)
+    : planner(mp), lineHead(0), lineTail(0), queued(0), receiveLength(0), overflow(false), lastLineNumber(0),
+      resendPending(false) {}
+
+  // Reads what has arrived without blocking, stops while the line queue is full
+  void poll() {
+    while (queued < hostLineCount && Serial.available() > 0) {
+      char c = Serial.read();
+      if (c == '\n' || c == '\r') {
+        if (receiveLength > 0 || overflow) finishLine();
+      } else if (receiveLength < lineBufferSize - 1) {
+        lines[lineTail][receiveLength++] = c;
+      } else {
+        overflow = true;
+      }
+    }
+  }
+
+  bool available() const {
+    return queued > 0;
+  }
+
+  // Waits for the next line and takes it out of the queue as a number, for prompts
+  int readNumber() {
+    while (!available()) {
+      poll();
+      yield();
+    }
+    int number = atoi(line());
+    next();
+    return number;
+  }
+
+  // Oldest queued line, only valid until next()
+  char* line() {
+    return lines[lineHead];
+  }
+
+  // Frees the oldest line and acknowledges it, the host may send the next one
+  void next() {
+    if (queued == 0) return;
+    lineHead = nextLineIndex(lineHead);
+    queued--;
+    sendOk();
+  }
+};
+
+#endif
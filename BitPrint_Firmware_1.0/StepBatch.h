@@ -0,0 +1,78 @@
+//This class collects the step pulses of one step timer call and sends them together: the step pins
+//are grouped by port, raised with one write per port, held for stepPulseMicros once and lowered again,
+//so a diagonal move costs one pulse width per tick instead of one per motor
+
+#ifndef STEPBATCH_H
+#define STEPBATCH_H
+
+#include <Arduino.h>
+#include "Config.h"
+#include "StepperController.h"
+
+class StepBatch {
+private:
+  StepPort ports[motorCount];
+  uint8_t masks[motorCount];
+  uint8_t portCount;
+#ifndef __AVR__
+  const StepperController* steppedMotors[motorCount];  // for stepHook, in the order of add()
+  uint8_t steppedCount;
+#endif
+
+public:
+#ifdef __AVR__
+  StepBatch() : portCount(0) {}
+#else
+  StepBatch() : portCount(0), steppedCount(0) {}
+#endif
+
+  bool pending(const StepperController& motor) const {
+    for (uint8_t i = 0; i < portCount; i++) {
+      if (ports[i] == motor.getStepPort()) return masks[i] & motor.getStepMask();
+    }
+    return false;
+  }
+
+  // Adds a step, a second step of the same motor first sends the steps collected so far
+  void add(const StepperController& motor) {
+    if (pending(motor)) send();
+#ifndef __AVR__
+    steppedMotors[steppedCount++] = &motor;
+#endif
+    for (uint8_t i = 0; i < portCount; i++) {
+      if (ports[i] == motor.getStepPort()) {
+        masks[i] |= motor.getStepMask();
+        return;
+      }
+    }
+    ports[portCount] = motor.getStepPort();
+    masks[portCount] = motor.getStepMask();
+    portCount++;
+  }
+
+  // Call before changing the direction pin of a motor, a collected step still needs the old direction
+  void beforeDirectionChange(const StepperController& motor) {
+    if (pending(motor)) send();
+  }
+
+  // Runs in the step timer interrupt, so the read-modify-write of the port registers can not be interrupted
+  void send() {
+    if (portCount == 0) return;
+#ifdef __AVR__
+    for (uint8_t i = 0; i < portCount; i++) *ports[i] |= masks[i];
+    delayMicroseconds(stepPulseMicros);
+    for (uint8_t i = 0; i < portCount; i++) *ports[i] &= ~masks[i];
+#else
+    for (uint8_t i = 0; i < portCount; i++) digitalWrite(ports[i], HIGH);
+    for (uint8_t i = 0; i < steppedCount; i++) {
+      if (stepHook) stepHook(*steppedMotors[i]);
+    }
+    steppedCount = 0;
+    delayMicroseconds(stepPulseMicros);
+    for (uint8_t i = 0; i < portCount; i++) digitalWrite(ports[i], LOW);
+#endif
+    portCount = 0;
+  }
+};
+
+#endif
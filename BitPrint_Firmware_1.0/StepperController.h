@@ -4,25 +4,84 @@
 #include <Arduino.h>
 #include "Config.h"
 
+#ifdef __AVR__
+typedef volatile uint8_t* StepPort;  // output register of the port the step pin is on
+#else
+typedef int StepPort;                // host builds write the step pin itself
+
+// Host tools watch the motors through these instead of the pins, pin numbers can be shared between motors
+class StepperController;
+inline void (*stepHook)(const StepperController& motor) = nullptr;
+inline void (*directionHook)(const StepperController& motor, bool forward) = nullptr;
+#endif
+
 class StepperController {
 private:
-  const char* name;
   int stepPin;
+  StepPort stepPort;
+  uint8_t stepMask;
   int dirPin;
   int enablePin;
   int limitPin;
   float stepsPerMM;
-  float currentPos;
+  float currentPos;    // last commanded position in mm
+  long currentSteps;   // machine position in whole steps, the reference for new moves
   bool enabled;
+  const int* microstepPins;  // MS1, MS2, MS3 or -1
+  uint8_t microsteps;        // resolution the driver is set to
+  uint8_t microstepPhase;    // driver position within one full step, in steps of microSteps
+
+  void advancePhase(long steps) {
+    microstepPhase = ((microstepPhase + steps) % microSteps + microSteps) % microSteps;
+  }
 
 public:
-  StepperController(int step, int dir, int enable, int limit, float stepsMM, float current)
-    : stepPin(step), dirPin(dir), enablePin(enable), limitPin(limit), stepsPerMM(stepsMM), currentPos(current), enabled(false) {
+  StepperController(int step, int dir, int enable, int limit, const int* msPins, float stepsMM, float current)
+    : stepPin(step), dirPin(dir), enablePin(enable), limitPin(limit), stepsPerMM(stepsMM), currentPos(current), currentSteps(lround(current * stepsMM)), enabled(false),
+      microstepPins(msPins), microstepPhase(0) {
     pinMode(stepPin, OUTPUT);
     pinMode(dirPin, OUTPUT);
     pinMode(enablePin, OUTPUT);
     pinMode(limitPin, OUTPUT);
     digitalWrite(enablePin, LOW);
+#ifdef __AVR__
+    stepPort = portOutputRegister(digitalPinToPort(stepPin));
+    stepMask = digitalPinToBitMask(stepPin);
+#else
+    stepPort = stepPin;
+    stepMask = 1;
+#endif
+    for (int i = 0; i < 3; i++) {
+      if (microstepPins[i] >= 0) pinMode(microstepPins[i], OUTPUT);
+    }
+    setMicrosteps(microSteps);
+  }
+
+  // MS1/MS2/MS3 levels of the A4988: full, half, quarter, eighth and sixteenth step
+  void setMicrosteps(int resolution) {
+    uint8_t levels = resolution == 2 ? 0b001 : resolution == 4 ? 0b010 : resolution == 8 ? 0b011 : resolution == 16 ? 0b111 : 0;
+    for (int i = 0; i < 3; i++) {
+      if (microstepPins[i] >= 0) digitalWrite(microstepPins[i], (levels >> i) & 1);
+    }
+    microsteps = resolution;
+  }
+
+  int getMicrosteps() const {
+    return microsteps;
+  }
+
+  bool hasMicrostepPins() const {
+    return microstepPins[0] >= 0 && microstepPins[1] >= 0 && microstepPins[2] >= 0;
+  }
+
+  // Counts steps sent by the planner, in steps of the current resolution
+  void addDriverSteps(long steps) {
+    advancePhase(steps * (microSteps / microsteps));
+  }
+
+  // True if the driver sits on a step of the given coarser resolution
+  bool alignedTo(int resolution) const {
+    return microstepPhase % (microSteps / resolution) == 0;
   }
 
   void enable() {
@@ -35,35 +94,30 @@ public:
     enabled = false;
   }
 
-  void pulseStepper(int speedMicros) {
-    digitalWrite(stepPin, HIGH);
-    delayMicroseconds(10);
-    digitalWrite(stepPin, LOW);
-    delayMicroseconds(speedMicros - 10);
+  void setDirection(bool forward) {
+    digitalWrite(dirPin, forward);
+#ifndef __AVR__
+    if (directionHook) directionHook(*this, forward);
+#endif
   }
 
-  void moveSingleMM(float targetPos, int speedMicros) {
-    float distance = targetPos - currentPos;
-    if (distance < 0) {
-      digitalWrite(dirPin, HIGH);
-    } else {
-      digitalWrite(dirPin, LOW);
-    }
-    distance = abs(distance);
-    int steps = round(distance * stepsPerMM);
-
-    for (int i = 0; i <= steps; i++) {
-      pulseStepper(speedMicros);
-    }
-
-    currentPos = targetPos;
+  int getStepPin() const {
+    return stepPin;
   }
 
   int getDirPin() const {
     return dirPin;
   }
 
-  int getStepsPerMM() const {
+  StepPort getStepPort() const {
+    return stepPort;
+  }
+
+  uint8_t getStepMask() const {
+    return stepMask;
+  }
+
+  float getStepsPerMM() const {
     return stepsPerMM;
   }
 
@@ -71,24 +125,70 @@ public:
     return currentPos;
   }
 
+  long getCurrentSteps() const {
+    return currentSteps;
+  }
+
+  // Moves the position by steps that were executed without being translated (a TXT file)
+  void addSteps(long steps) {
+    currentSteps += steps;
+    currentPos = currentSteps / stepsPerMM;
+  }
+
+  // Sets the commanded position and the machine position to the step nearest to it
   void setCurrentPos(float input) {
     currentPos = input;
+    currentSteps = lround(input * stepsPerMM);
   }
 
-  void home() {
-    Serial.print("Homing started for ");
-    Serial.println(name);
-    digitalWrite(dirPin, LOW);
-    while (digitalRead(limitPin) != 0) {
-      pulseStepper(400);
+  bool atLimit() const {
+    return digitalRead(limitPin) == 0;
+  }
+
+  // One step pulse while homing, the caller waits for the rest of homingStepMicros
+  void homingPulse(bool forward) {
+    digitalWrite(stepPin, HIGH);
+#ifndef __AVR__
+    if (stepHook) stepHook(*this);
+#endif
+    delayMicroseconds(stepPulseMicros);
+    digitalWrite(stepPin, LOW);
+    advancePhase(forward ? 1 : -1);
+  }
+
+  // Homes the motors of one axis together: they step at the same time and each one stops at its own
+  // switch, so the second motor of a shared gantry (dual Z) is never left behind while the first moves
+  static void home(StepperController* const group[], int count) {
+    for (int i = 0; i < count; i++) {
+      Serial.print("Homing started for step pin ");
+      Serial.println(group[i]->stepPin);
+      group[i]->setMicrosteps(microSteps);
+      group[i]->setDirection(false);
+    }
+    bool moving = true;
+    while (moving) {
+      moving = false;
+      for (int i = 0; i < count; i++) {
+        if (group[i]->atLimit()) continue;
+        group[i]->homingPulse(false);
+        moving = true;
+      }
+      if (moving) delayMicroseconds(homingStepMicros - stepPulseMicros);
+      receiveSerial();
     }
     delay(200);
-    digitalWrite(dirPin, HIGH);
-    for (int i = 0; i < 10; i++) {
-      pulseStepper(400);
+
+    // back off the switches
+    for (int i = 0; i < count; i++) group[i]->setDirection(true);
+    for (int step = 0; step < 10; step++) {
+      for (int i = 0; i < count; i++) group[i]->homingPulse(true);
+      delayMicroseconds(homingStepMicros - stepPulseMicros);
     }
     delay(500);
-    currentPos = 0;
+    for (int i = 0; i < count; i++) {
+      group[i]->currentPos = 0;
+      group[i]->currentSteps = 0;
+    }
   }
 };
 
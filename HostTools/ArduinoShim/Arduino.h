@@ -0,0 +1,301 @@
+// Minimal Arduino API for building the firmware headers on a Linux host.
+// Only what the firmware uses is here; behaviour that ends up in files (println line
+// endings, String parsing) follows the Arduino core so host output matches the board.
+
+#ifndef ARDUINO_SHIM_H
+#define ARDUINO_SHIM_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <cmath>
+#include <cstdlib>
+#include <string>
+#include <chrono>
+#include <time.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+// double is float on the AVR: the float overloads are picked for float arguments, atof parses
+// to float and the Makefile builds with -fsingle-precision-constant, so the host rounds the same way
+using std::abs;
+using std::exp;
+using std::isnan;
+using std::round;
+using std::sqrt;
+#define atof(text) strtof((text), nullptr)
+
+typedef uint8_t byte;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+
+#define PI 3.1415926535897932384626433832795
+
+template <class A, class B>
+inline auto min(A a, B b) -> decltype(a + b) { return a < b ? a : b; }
+template <class A, class B>
+inline auto max(A a, B b) -> decltype(a + b) { return a > b ? a : b; }
+// no separate flash address space on the host
+#define PROGMEM
+#define pgm_read_dword(address) (*(const uint32_t*)(address))
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+// Pin access is routed through a hook so host tools can record the pin sequence
+typedef void (*PinWriteHook)(int pin, int value);
+inline PinWriteHook pinWriteHook = nullptr;
+
+inline void pinMode(int, int) {}
+inline void digitalWrite(int pin, int value) {
+  if (pinWriteHook) pinWriteHook(pin, value);
+}
+inline int digitalRead(int) { return 0; }  // limit switches read as triggered
+
+// Host tools that replay a print install a timerHook in place of the step timer interrupt. It returns
+// the micros until its next call like the ISR reloads OCR1A. Time is then virtual: yield(), called by
+// the firmware wherever it waits for the steppers, jumps to the next timer call and micros() follows.
+// With realTimeTimer set, time is the host clock and yield() makes every timer call that is due.
+typedef unsigned long (*TimerHook)();
+inline TimerHook timerHook = nullptr;
+inline bool realTimeTimer = false;
+inline unsigned long virtualMicros = 0;
+inline unsigned long nextTimerMicros = 0;
+
+inline unsigned long hostMicros() {
+  using namespace std::chrono;
+  return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+inline unsigned long micros() {
+  if (timerHook && !realTimeTimer) return virtualMicros;
+  return hostMicros();
+}
+inline unsigned long millis() { return micros() / 1000; }
+inline void delay(unsigned long) {}
+inline void delayMicroseconds(unsigned int) {}
+inline void yield() {
+  if (!timerHook) return;
+  if (realTimeTimer) {
+    unsigned long now = hostMicros();
+    if (nextTimerMicros == 0) nextTimerMicros = now;
+    while ((long)(now - nextTimerMicros) >= 0) nextTimerMicros += timerHook();
+    return;
+  }
+  virtualMicros = nextTimerMicros;
+  nextTimerMicros += timerHook();
+}
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+class String {
+private:
+  std::string s;
+
+public:
+  String(const char* c = "") : s(c ? c : "") {}
+  String(const std::string& str) : s(str) {}
+  String(char c) : s(1, c) {}
+  String(int v) : s(std::to_string(v)) {}
+  String(long v) : s(std::to_string(v)) {}
+
+  unsigned int length() const { return s.size(); }
+  const char* c_str() const { return s.c_str(); }
+  char charAt(unsigned int i) const { return i < s.size() ? s[i] : 0; }
+  char operator[](unsigned int i) const { return charAt(i); }
+
+  int indexOf(char c, unsigned int from = 0) const { return find(s.find(c, from)); }
+  int indexOf(const char* str, unsigned int from = 0) const { return find(s.find(str, from)); }
+  int lastIndexOf(char c) const { return find(s.rfind(c)); }
+  bool startsWith(const char* prefix) const { return s.compare(0, strlen(prefix), prefix) == 0; }
+  bool endsWith(const char* suffix) const {
+    size_t n = strlen(suffix);
+    return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+  }
+
+  String substring(unsigned int from) const { return from < s.size() ? s.substr(from) : ""; }
+  String substring(unsigned int from, int to) const {
+    if (to < 0 || (unsigned int)to > s.size()) to = s.size();
+    return from < (unsigned int)to ? s.substr(from, to - from) : "";
+  }
+
+  long toInt() const { return atol(s.c_str()); }
+  float toFloat() const { return atof(s.c_str()); }
+
+  void trim() {
+    size_t begin = s.find_first_not_of(" \t\r\n\f\v");
+    if (begin == std::string::npos) {
+      s.clear();
+      return;
+    }
+    size_t end = s.find_last_not_of(" \t\r\n\f\v");
+    s = s.substr(begin, end - begin + 1);
+  }
+  void remove(unsigned int index) {
+    if (index < s.size()) s.erase(index);
+  }
+  void toUpperCase() {
+    for (size_t i = 0; i < s.size(); i++) s[i] = toupper(s[i]);
+  }
+
+  String& operator+=(char c) { s += c; return *this; }
+  String& operator+=(const String& other) { s += other.s; return *this; }
+  String operator+(const char* other) const { return s + other; }
+  String operator+(const String& other) const { return s + other.s; }
+  bool operator==(const String& other) const { return s == other.s; }
+  bool operator==(const char* other) const { return s == other; }
+  bool operator!=(const String& other) const { return s != other.s; }
+
+private:
+  static int find(size_t pos) { return pos == std::string::npos ? -1 : (int)pos; }
+};
+
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t* buffer, size_t size) {
+    for (size_t i = 0; i < size; i++) write(buffer[i]);
+    return size;
+  }
+  virtual int availableForWrite() { return 64; }
+
+  size_t print(const char* str) { return write((const uint8_t*)str, strlen(str)); }
+  size_t print(const String& str) { return print(str.c_str()); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(int v) { return print((long)v); }
+  size_t print(unsigned int v) { return print((unsigned long)v); }
+  size_t print(long v) { return printf("%ld", v); }
+  size_t print(unsigned long v) { return printf("%lu", v); }
+  size_t print(double v, int digits = 2) { return printf("%.*f", digits, v); }
+
+  size_t println() { return print("\r\n"); }
+  template <class T>
+  size_t println(T v) {
+    size_t n = print(v);
+    return n + println();
+  }
+
+private:
+  size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+};
+
+inline size_t Print::printf(const char* format, ...) {
+  char buffer[64];
+  va_list args;
+  va_start(args, format);
+  int n = vsnprintf(buffer, sizeof(buffer), format, args);
+  va_end(args);
+  return n > 0 ? write((const uint8_t*)buffer, strlen(buffer)) : 0;
+}
+
+class Stream : public Print {
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+
+  String readStringUntil(char terminator) {
+    String result;
+    int c;
+    while ((c = read()) >= 0 && c != terminator) result += (char)c;
+    return result;
+  }
+
+  size_t readBytesUntil(char terminator, char* buffer, size_t length) {
+    size_t count = 0;
+    int c;
+    while (count < length && (c = read()) >= 0 && c != terminator) buffer[count++] = (char)c;
+    return count;
+  }
+};
+
+// Serial output goes to stderr so tools can keep stdout for their own results,
+// a tool can attach a file descriptor (a pty) that is used for input and output instead
+// Received bytes go through a 64 byte buffer like SERIAL_RX_BUFFER_SIZE of the AVR core. Bytes the host
+// wrote arrive one per character time at the baud rate, when the firmware did not read them in time
+// the buffer is full and they are dropped like on the board. Dropped bytes are reported on stderr.
+// The wire runs on the CPU time of the process, so the firmware is not blamed for the time the host
+// scheduler gave to another process.
+class HardwareSerial : public Stream {
+private:
+  static const int rxBufferSize = 64;
+  int fd = -1;
+  unsigned long byteMicros = 0;  // 10 bits per byte, 0 = no baud rate set
+  unsigned char rx[rxBufferSize];
+  int rxHead = 0;
+  int rxCount = 0;
+  unsigned long wireMicros = 0;    // when the byte on the wire has fully arrived
+  unsigned long lastReceive = 0;
+  bool wireIdle = true;            // nothing was left on the wire at the last receive()
+  unsigned long dropped = 0;
+
+  void receive() {
+    if (fd < 0) return;
+    timespec cpu;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu);
+    unsigned long now = cpu.tv_sec * 1000000UL + cpu.tv_nsec / 1000;
+    int pending = 0;
+    if (ioctl(fd, FIONREAD, &pending) != 0) pending = 0;
+    // bytes that were not on the wire last time were written after it
+    if (wireIdle && (long)(lastReceive - wireMicros) > 0) wireMicros = lastReceive;
+    lastReceive = now;
+    int arrived = pending;
+    if (byteMicros > 0 && (long)(now - wireMicros) < (long)byteMicros * pending) {
+      arrived = (long)(now - wireMicros) > 0 ? (now - wireMicros) / byteMicros : 0;
+    }
+    unsigned long droppedBefore = dropped;
+    for (int i = 0; i < arrived; i++) {
+      unsigned char c;
+      if (::read(fd, &c, 1) != 1) break;
+      if (rxCount < rxBufferSize) {
+        rx[(rxHead + rxCount) % rxBufferSize] = c;
+        rxCount++;
+      } else {
+        dropped++;
+      }
+    }
+    if (dropped != droppedBefore) fprintf(stderr, "serial RX buffer overrun, %lu bytes dropped\n", dropped);
+    wireMicros += arrived * byteMicros;
+    wireIdle = arrived == pending;
+  }
+
+public:
+  void attach(int descriptor) { fd = descriptor; }
+  void begin(unsigned long baud) { byteMicros = baud > 0 ? (10000000 + baud - 1) / baud : 0; }
+  void flush() { fflush(stderr); }
+  int available() override {
+    receive();
+    return rxCount;
+  }
+  int read() override {
+    int c = peek();
+    if (c >= 0) {
+      rxHead = (rxHead + 1) % rxBufferSize;
+      rxCount--;
+    }
+    return c;
+  }
+  int peek() override {
+    if (rxCount == 0) receive();
+    return rxCount > 0 ? rx[rxHead] : -1;
+  }
+  unsigned long droppedBytes() const { return dropped; }
+  size_t write(uint8_t c) override {
+    if (fd >= 0) return ::write(fd, &c, 1) == 1 ? 1 : 0;
+    return fputc(c, stderr) == EOF ? 0 : 1;
+  }
+  using Print::write;
+  operator bool() const { return true; }
+};
+
+inline HardwareSerial Serial;
+
+#endif
@@ -0,0 +1,107 @@
+// SD card API on top of the host file system, paths are relative to the working directory
+// and the card root ("/") is the working directory itself
+
+#ifndef SD_SHIM_H
+#define SD_SHIM_H
+
+#include "Arduino.h"
+#include <memory>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#define FILE_READ 0
+#define FILE_WRITE 1
+
+class File : public Stream {
+private:
+  std::shared_ptr<FILE> file;
+  std::shared_ptr<DIR> dir;
+  String fileName;
+
+public:
+  File() {}
+  File(FILE* f, const char* name) : file(f, fclose), fileName(name) {}
+  File(DIR* d, const char* name) : dir(d, closedir), fileName(name) {}
+
+  operator bool() const { return file || dir; }
+  const char* name() const { return fileName.c_str(); }
+  bool isDirectory() const { return (bool)dir; }
+
+  // Files of a directory, name() is the name without the directory like on the card
+  File openNextFile() {
+    if (!dir) return File();
+    while (dirent* entry = readdir(dir.get())) {
+      if (entry->d_name[0] == '.' || entry->d_type == DT_DIR) continue;
+      String path = fileName + "/" + entry->d_name;
+      FILE* f = fopen(path.c_str(), "rb");
+      if (f) return File(f, entry->d_name);
+    }
+    return File();
+  }
+
+  int available() override {
+    if (!file) return 0;
+    long remaining = (long)size() - (long)position();
+    return remaining > 0x7FFF ? 0x7FFF : remaining;  // like the SD library, which returns an int
+  }
+  int read() override { return file ? fgetc(file.get()) : -1; }
+  int peek() override {
+    if (!file) return -1;
+    int c = fgetc(file.get());
+    if (c != EOF) ungetc(c, file.get());
+    return c;
+  }
+  int read(void* buffer, size_t length) { return file ? fread(buffer, 1, length, file.get()) : -1; }
+  size_t write(uint8_t c) override { return file && fputc(c, file.get()) != EOF ? 1 : 0; }
+  size_t write(const uint8_t* buffer, size_t size) override { return file ? fwrite(buffer, 1, size, file.get()) : 0; }
+  using Print::write;
+
+  uint32_t position() { return file ? ftell(file.get()) : 0; }
+  bool seek(uint32_t pos) { return file && fseek(file.get(), pos, SEEK_SET) == 0; }
+  uint32_t size() {
+    if (!file) return 0;
+    long pos = ftell(file.get());
+    fseek(file.get(), 0, SEEK_END);
+    long end = ftell(file.get());
+    fseek(file.get(), pos, SEEK_SET);
+    return end;
+  }
+  void flush() {
+    if (file) fflush(file.get());
+  }
+  void close() { file.reset(); }
+};
+
+class SDClass {
+public:
+  bool begin(int) { return true; }
+
+  // FILE_WRITE creates the file and starts at its end, like the SD library
+  File open(const char* path, uint8_t mode = FILE_READ) {
+    if (strcmp(path, "/") == 0) path = ".";
+    struct stat info;
+    if (stat(path, &info) == 0 && S_ISDIR(info.st_mode)) {
+      DIR* d = opendir(path);
+      return d ? File(d, path) : File();
+    }
+    FILE* f = fopen(path, mode == FILE_WRITE ? "ab+" : "rb");
+    if (!f) return File();
+    if (mode == FILE_WRITE) fseek(f, 0, SEEK_END);
+    return File(f, path);
+  }
+  File open(const String& path, uint8_t mode = FILE_READ) { return open(path.c_str(), mode); }
+  bool exists(const char* path) { return access(path); }
+  bool remove(const char* path) { return ::remove(path) == 0; }
+  bool remove(const String& path) { return remove(path.c_str()); }
+
+private:
+  static bool access(const char* path) {
+    FILE* f = fopen(path, "rb");
+    if (f) fclose(f);
+    return f != nullptr;
+  }
+};
+
+inline SDClass SD;
+
+#endif
@@ -0,0 +1 @@
+// SPI is only used by the SD card, which the host shim maps to the local file system
@@ -0,0 +1,19 @@
+// Names of the TXT cache and layer index for a .gco file, the same as FileManager uses on the card:
+// base name without extension, 8.3 style upper case, next to the input file
+
+#ifndef CACHEFILES_H
+#define CACHEFILES_H
+
+#include <Arduino.h>
+
+inline void cacheFileNames(const String& gcoFileName, String& txtFileName, String& idxFileName) {
+  int slash = gcoFileName.lastIndexOf('/');
+  String directory = slash >= 0 ? gcoFileName.substring(0, slash + 1) : "";
+  String base = gcoFileName.substring(slash + 1);
+  if (base.lastIndexOf('.') > 0) base.remove(base.lastIndexOf('.'));
+  base.toUpperCase();
+  txtFileName = directory + base + ".TXT";
+  idxFileName = directory + base + ".IDX";
+}
+
+#endif
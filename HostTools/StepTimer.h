@@ -0,0 +1,12 @@
+// The step timer interrupt of the firmware for the host tools: the shim calls timerHook on its clock
+// like Timer1 would, include after BitPrint_Firmware_1.0.ino
+
+#ifndef STEPTIMER_H
+#define STEPTIMER_H
+
+// Like the ISR, stepTick() already returns whole 4us timer ticks
+inline unsigned long stepTimer() {
+  return motionPlanner.stepTick();
+}
+
+#endif
@@ -0,0 +1,31 @@
+// Host-side G-code preprocessing: translates a .gco file into the TXT cache (and layer index)
+// the firmware executes, using the firmware's own FileManager / GcodeParser / MotionPlanner code.
+// Copy the .gco, .TXT and .IDX files to the SD card and the printer skips translation.
+//
+// usage: gcode2txt <file.gco>...   writes <FILE>.TXT and <FILE>.IDX next to each input
+//   several files are translated one after the other in one session, like consecutive prints on the board
+
+#include "BitPrint_Firmware_1.0.ino"
+#include "CacheFiles.h"
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <file.gco>...\n", argv[0]);
+    return 2;
+  }
+
+  for (int i = 1; i < argc; i++) {
+    String gcoFileName = argv[i];
+    String txtFileName, idxFileName;
+    cacheFileNames(gcoFileName, txtFileName, idxFileName);
+
+    unsigned long start = micros();
+    if (!fileManager.createTxtFile(gcoFileName.c_str(), txtFileName.c_str(), idxFileName.c_str())) {
+      return 1;
+    }
+    unsigned long elapsed = micros() - start;
+
+    printf("%s -> %s, %s in %.3f s\n", gcoFileName.c_str(), txtFileName.c_str(), idxFileName.c_str(), elapsed / 1e6);
+  }
+  return 0;
+}
@@ -0,0 +1,144 @@
+#!/usr/bin/env python3
+# Streams G-code to serialsim over its pty the way a host (Pronterface, OctoPrint) does: every line with
+# line number and checksum, several lines in flight, resends answered. One checksum is corrupted on
+# purpose. Fails if a line is not acknowledged, the resend is missing, the planner queue ran empty while
+# the firmware had the next line, or serialsim reports that its 64 byte RX buffer overflowed.
+#
+# usage: serialcheck.py <serialsim> <file.gcode> [line count]
+
+import os
+import re
+import select
+import subprocess
+import sys
+import tempfile
+import time
+import tty
+
+WINDOW = 4           # lines in flight, hostLineCount in Config.h
+CORRUPT_LINE = 50    # line number sent once with a wrong checksum
+FEEDRATE = 400       # M220, the host has to keep up with a faster print
+TIMEOUT = 20         # seconds without any reply
+
+
+class Connection:
+    def __init__(self, path):
+        self.fd = os.open(path, os.O_RDWR | os.O_NOCTTY)
+        tty.setraw(self.fd)
+        self.buffer = b''
+
+    def send(self, text):
+        os.write(self.fd, text.encode())
+
+    def readline(self):
+        while b'\n' not in self.buffer:
+            ready, _, _ = select.select([self.fd], [], [], TIMEOUT)
+            if not ready:
+                raise TimeoutError('no reply from serialsim')
+            self.buffer += os.read(self.fd, 4096)
+        line, self.buffer = self.buffer.split(b'\n', 1)
+        return line.decode(errors='replace').strip()
+
+
+def framed(number, command):
+    text = 'N%d %s' % (number, command)
+    checksum = 0
+    for c in text.encode():
+        checksum ^= c
+    return '%s*%d\n' % (text, checksum)
+
+
+def commands(fileName, count):
+    result = []
+    with open(fileName) as f:
+        for line in f:
+            line = line.split(';')[0].strip()
+            if line:
+                result.append(line)
+            if len(result) == count:
+                break
+    return result
+
+
+def main():
+    if len(sys.argv) not in (3, 4):
+        print('usage: %s <serialsim> <file.gcode> [line count]' % sys.argv[0], file=sys.stderr)
+        return 2
+    count = int(sys.argv[3]) if len(sys.argv) == 4 else 2000
+
+    errors = tempfile.TemporaryFile()
+    sim = subprocess.Popen([sys.argv[1]], stdout=subprocess.PIPE, stderr=errors)
+    try:
+        host = Connection(sim.stdout.readline().decode().strip())
+        while 'send G-code' not in host.readline():
+            pass
+
+        # line 1 is M110 N0 (resets the numbering), line numbers of the rest follow their index
+        lines = ['M110 N0', 'M220 S%d' % FEEDRATE] + commands(sys.argv[2], count) + ['M400', 'M991']
+        nextLine = 0
+        inFlight = 0
+        oks = 0
+        resends = []
+        corrupted = False
+        stats = None
+        timedOut = False
+        start = time.time()
+        # the ok of M991 follows its statistics
+        while (stats is None or inFlight > 0) and not timedOut:
+            while inFlight < WINDOW and nextLine < len(lines):
+                text = framed(nextLine, lines[nextLine])
+                if nextLine == CORRUPT_LINE and not corrupted:
+                    text = text.replace('*', '*1')
+                    corrupted = True
+                host.send(text)
+                nextLine += 1
+                inFlight += 1
+
+            try:
+                reply = host.readline()
+            except TimeoutError:
+                timedOut = True
+                continue
+            if reply.startswith('ok'):
+                oks += 1
+                inFlight -= 1
+            elif reply.startswith('Resend:'):
+                resends.append(int(reply.split()[1]))
+                nextLine = resends[-1]
+            elif reply.startswith('Queue underruns:'):
+                stats = reply
+        elapsed = time.time() - start
+    finally:
+        sim.kill()
+        sim.wait()
+    errors.seek(0)
+    overruns = [line for line in errors.read().decode(errors='replace').splitlines() if 'overrun' in line]
+
+    print('%d lines in %.1f s (%.0f lines/s), %d ok, resends %s' %
+          (len(lines), elapsed, len(lines) / elapsed, oks, resends))
+    failed = False
+    if stats is None:
+        print('no reply from serialsim for %d s' % TIMEOUT)
+        stats = 'Queue underruns: 0'
+        failed = True
+    else:
+        print(stats)
+    underruns = int(re.match(r'Queue underruns: (\d+)', stats).group(1))
+    if resends != [CORRUPT_LINE]:
+        print('expected one resend of line %d' % CORRUPT_LINE)
+        failed = True
+    if inFlight != 0:
+        print('%d lines not acknowledged' % inFlight)
+        failed = True
+    if underruns != 0:
+        print('planner queue ran empty while streaming')
+        failed = True
+    if overruns:
+        print(overruns[-1])
+        failed = True
+    print('serial check failed' if failed else 'serial check passed')
+    return 1 if failed else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
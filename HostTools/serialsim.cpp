@@ -0,0 +1,49 @@
+// Runs the firmware against a pseudo terminal so a host program (Pronterface, OctoPrint, a test script)
+// can talk to it like to the board. The step timer runs on the host clock, the steps are not output.
+// The working directory is the root of the SD card.
+//
+// usage: serialsim [card directory]
+//   prints the pty to connect to, runs until killed
+
+#include <fcntl.h>
+#include <termios.h>
+#include "BitPrint_Firmware_1.0.ino"
+#include "StepTimer.h"
+
+int main(int argc, char** argv) {
+  if (argc > 2) {
+    fprintf(stderr, "usage: %s [card directory]\n", argv[0]);
+    return 2;
+  }
+  if (argc == 2 && chdir(argv[1]) != 0) {
+    perror(argv[1]);
+    return 2;
+  }
+
+  int pty = posix_openpt(O_RDWR | O_NOCTTY);
+  if (pty < 0 || grantpt(pty) != 0 || unlockpt(pty) != 0) {
+    perror("pty");
+    return 2;
+  }
+  // keep the other side open so the pty stays usable while no host is connected, in raw mode like a UART
+  int device = open(ptsname(pty), O_RDWR | O_NOCTTY);
+  if (device < 0) {
+    perror(ptsname(pty));
+    return 2;
+  }
+  termios settings;
+  tcgetattr(device, &settings);
+  cfmakeraw(&settings);
+  tcsetattr(device, TCSANOW, &settings);
+  printf("%s\n", ptsname(pty));
+  fflush(stdout);
+
+  Serial.attach(pty);
+  realTimeTimer = true;
+  timerHook = stepTimer;
+  setup();
+  for (;;) {
+    loop();
+    yield();
+  }
+}
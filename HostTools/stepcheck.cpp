@@ -0,0 +1,142 @@
+// Final position check of a translation: translates a .gco file like gcode2txt, adds up the steps of
+// every move record in the TXT cache per axis and compares the sums with the final G-code position,
+// worked out again from the .gco in double precision and converted to steps once. Next to it the
+// steps a per-move truncating conversion would have ended on, which is what the parser did before.
+//
+// usage: stepcheck <file.gco>
+//   exit code 0 = every axis ends on the exact step, 1 = an axis is off, 2 = error
+
+#include "BitPrint_Firmware_1.0.ino"
+#include "CacheFiles.h"
+
+// The host tools build with -fsingle-precision-constant and the shim maps atof to float, so this
+// file only uses integer constants and strtod
+
+static const int columnCount = axisCount + toolCount - 1;  // X, Y, Z and one E per tool
+
+static int column(int axis, int tool) {
+  return axis == E_AXIS ? E_AXIS + tool : axis;
+}
+
+static double stepsPerMM(int axis, int tool) {
+  if (axis == X_AXIS) return stepsPerMMX;
+  if (axis == Y_AXIS) return stepsPerMMY;
+  if (axis == Z_AXIS) return stepsPerMMZ;
+  return tool == 0 ? stepsPerMME : stepsPerMME1;
+}
+
+static bool isWord(const char* line, const char* word) {
+  size_t length = strlen(word);
+  return strncmp(line, word, length) == 0 && (line[length] == '\0' || line[length] == ' ');
+}
+
+struct Interpretation {
+  double position[columnCount] = {};  // machine position in mm
+  long truncating[columnCount] = {};  // steps of the old conversion: truncated difference per move
+};
+
+// Same G-code subset and machine coordinates as GcodeParser, in double and without merging moves
+static bool interpret(const char* gcoFileName, Interpretation& result) {
+  FILE* f = fopen(gcoFileName, "r");
+  if (!f) return false;
+
+  int tool = 0;
+  bool relativeAxes = false, relativeExtrusion = false;
+  double axisOffset[axisCount] = {};
+  char line[256];
+  while (fgets(line, sizeof(line), f)) {
+    char* end = strpbrk(line, ";\r\n");
+    if (end) *end = '\0';
+
+    if (isWord(line, "G0") || isWord(line, "G1")) {
+      for (int i = 0; i < axisCount; i++) {
+        const char* value = strchr(line, axisLetters[i]);
+        if (!value) continue;
+        int c = column(i, tool);
+        double offset = i == X_AXIS ? toolOffsetX[tool] : i == Y_AXIS ? toolOffsetY[tool] : i == Z_AXIS ? zOffset : 0;
+        bool relative = i == E_AXIS ? relativeExtrusion : relativeAxes;
+        double target = strtod(value + 1, nullptr) + (relative ? result.position[c] : axisOffset[i] + offset);
+        double difference = (target - result.position[c]) * stepsPerMM(i, tool);
+        result.truncating[c] += (long)difference;
+        result.position[c] = target;
+      }
+    } else if (isWord(line, "G28")) {
+      for (int i = 0; i < E_AXIS; i++) {
+        result.position[i] = 0;
+        result.truncating[i] = 0;
+      }
+    } else if (isWord(line, "G90") || isWord(line, "G91")) {
+      relativeAxes = relativeExtrusion = isWord(line, "G91");
+    } else if (isWord(line, "M82") || isWord(line, "M83")) {
+      relativeExtrusion = isWord(line, "M83");
+    } else if (isWord(line, "G92")) {
+      for (int i = 0; i < axisCount; i++) {
+        const char* value = strchr(line, axisLetters[i]);
+        if (!value) continue;
+        double offset = i == X_AXIS ? toolOffsetX[tool] : i == Y_AXIS ? toolOffsetY[tool] : i == Z_AXIS ? zOffset : 0;
+        axisOffset[i] = result.position[column(i, tool)] - offset - strtod(value + 1, nullptr);
+      }
+    } else if (line[0] == 'T') {
+      int next = atoi(line + 1);
+      if (next >= 0 && next < toolCount) tool = next;
+    }
+  }
+  fclose(f);
+  return true;
+}
+
+// Sum of the steps of all move records (M followed by an axis or S) after the last G28
+static bool sumCache(const char* txtFileName, long sums[columnCount]) {
+  FILE* f = fopen(txtFileName, "r");
+  if (!f) return false;
+
+  int tool = 0;
+  char line[256];
+  while (fgets(line, sizeof(line), f)) {
+    if (line[0] == 'M' && isalpha(line[1])) {
+      for (int i = 0; i < axisCount; i++) {
+        const char* value = strchr(line, axisLetters[i]);
+        if (value) sums[column(i, tool)] += atol(value + 1);
+      }
+    } else if (strncmp(line, "G28", 3) == 0) {
+      for (int i = 0; i < E_AXIS; i++) sums[i] = 0;
+    } else if (line[0] == 'T') {
+      tool = atoi(line + 1);
+    }
+  }
+  fclose(f);
+  return true;
+}
+
+int main(int argc, char** argv) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s <file.gco>\n", argv[0]);
+    return 2;
+  }
+
+  String gcoFileName = argv[1];
+  String txtFileName, idxFileName;
+  cacheFileNames(gcoFileName, txtFileName, idxFileName);
+  if (!fileManager.createTxtFile(gcoFileName.c_str(), txtFileName.c_str(), idxFileName.c_str())) {
+    return 2;
+  }
+
+  Interpretation exact;
+  long cache[columnCount] = {};
+  if (!interpret(gcoFileName.c_str(), exact) || !sumCache(txtFileName.c_str(), cache)) {
+    fprintf(stderr, "could not read %s or %s\n", gcoFileName.c_str(), txtFileName.c_str());
+    return 2;
+  }
+
+  bool match = true;
+  printf("axis  %10s %10s %10s\n", "cache", "exact", "truncating");
+  for (int c = 0; c < columnCount; c++) {
+    int axis = c < E_AXIS ? c : E_AXIS;
+    long target = lround(exact.position[c] * stepsPerMM(axis, c - axis));
+    if (cache[c] != target) match = false;
+    char name[4];
+    snprintf(name, sizeof(name), c < E_AXIS ? "%c" : "%c%d", axisLetters[axis], c - axis);
+    printf("%-4s  %10ld %10ld %10ld%s\n", name, cache[c], target, exact.truncating[c], cache[c] != target ? "  MISMATCH" : "");
+  }
+  return match ? 0 : 1;
+}
@@ -0,0 +1,246 @@
+// Deterministic replay of a print: translates a .gco file like gcode2txt, runs the TXT cache through the
+// firmware's Executor and MotionPlanner with the step timer on a virtual clock and records every step
+// (motor, direction, time). Compared against a golden trace recorded before a change it shows whether
+// the change moved any step or only changed the timing.
+//
+// usage: steptrace <file.gco> <out.trace> [golden.trace]
+//   exit code 0 = no golden trace or identical, 1 = traces differ, 2 = error
+
+#include "BitPrint_Firmware_1.0.ino"
+#include "CacheFiles.h"
+#include "StepTimer.h"
+
+// Trace file: header, then one record per step: motor | direction << 7, time since the previous
+// step in micros as a varint (7 bits per byte, low bits first)
+static const char traceMagic[4] = { 'B', 'P', 'S', 'T' };
+static const uint8_t traceVersion = 1;
+
+struct StepEvent {
+  uint8_t motor;
+  bool dir;
+  unsigned long time;
+};
+
+struct TraceSummary {
+  unsigned long events = 0;
+  unsigned long endTime = 0;
+  long forward[motorCount] = {};
+  long backward[motorCount] = {};
+};
+
+static FILE* traceOut;
+static unsigned long lastEventTime;
+static bool motorDir[motorCount];
+
+static void writeVarint(FILE* f, unsigned long value) {
+  do {
+    uint8_t b = value & 0x7F;
+    value >>= 7;
+    fputc(value ? b | 0x80 : b, f);
+  } while (value);
+}
+
+static bool readVarint(FILE* f, unsigned long& value) {
+  value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    int b = fgetc(f);
+    if (b == EOF) return false;
+    value |= (unsigned long)(b & 0x7F) << shift;
+    if (!(b & 0x80)) return true;
+  }
+  return false;
+}
+
+// Motors are told apart by their StepperController, not by pin: Config.h may share pins between them
+static int motorIndex(const StepperController& motor) {
+  for (int m = 0; m < motorCount; m++) {
+    if (motors[m] == &motor) return m;
+  }
+  return -1;
+}
+
+static void recordDirection(const StepperController& controller, bool forward) {
+  int motor = motorIndex(controller);
+  if (motor >= 0) motorDir[motor] = forward;
+}
+
+static void recordStep(const StepperController& controller) {
+  int motor = motorIndex(controller);
+  if (motor < 0) return;
+
+  unsigned long now = micros();
+  fputc(motor | (motorDir[motor] ? 0x80 : 0), traceOut);
+  writeVarint(traceOut, now - lastEventTime);
+  lastEventTime = now;
+}
+
+class TraceReader {
+private:
+  FILE* file;
+  unsigned long time;
+
+public:
+  TraceReader() : file(nullptr), time(0) {}
+  ~TraceReader() {
+    if (file) fclose(file);
+  }
+
+  bool open(const char* fileName) {
+    file = fopen(fileName, "rb");
+    if (!file) return false;
+    char magic[4];
+    if (fread(magic, 1, 4, file) != 4 || memcmp(magic, traceMagic, 4) != 0) return false;
+    return fgetc(file) == traceVersion && fgetc(file) == motorCount;
+  }
+
+  bool next(StepEvent& event) {
+    int b = fgetc(file);
+    if (b == EOF) return false;
+    unsigned long delta;
+    if (!readVarint(file, delta)) return false;
+    time += delta;
+    event.motor = b & 0x7F;
+    event.dir = b & 0x80;
+    event.time = time;
+    return event.motor < motorCount;
+  }
+};
+
+static void count(TraceSummary& summary, const StepEvent& event) {
+  summary.events++;
+  summary.endTime = event.time;
+  if (event.dir) summary.forward[event.motor]++;
+  else summary.backward[event.motor]++;
+}
+
+// X, Y, Z, Z2 for the second motor of an axis, E0 / E1 for the extruder of each tool
+static String motorName(int motor) {
+  String name = String(axisLetters[motorAxis[motor]]);
+  int sameAxis = 0;
+  for (int i = 0; i < motor; i++) {
+    if (motorAxis[i] == motorAxis[motor]) sameAxis++;
+  }
+  if (motorTool[motor] != allTools) name += String(motorTool[motor]);
+  else if (sameAxis > 0) name += String(sameAxis + 1);
+  return name;
+}
+
+static void printEvent(const char* label, const StepEvent& event) {
+  printf("  %s: %s %s at %.6f s\n", label, motorName(event.motor).c_str(), event.dir ? "+" : "-", event.time / 1e6);
+}
+
+static void printSummary(const char* label, const TraceSummary& summary) {
+  printf("%s: %lu steps, print time %.3f s\n", label, summary.events, summary.endTime / 1e6);
+  for (int m = 0; m < motorCount; m++) {
+    printf("  %-3s +%ld -%ld net %ld\n", motorName(m).c_str(), summary.forward[m], summary.backward[m],
+           summary.forward[m] - summary.backward[m]);
+  }
+}
+
+// Returns true if both traces hold the same steps at the same times
+static bool compareTraces(const char* traceFileName, const char* goldenFileName) {
+  TraceReader trace, golden;
+  if (!trace.open(traceFileName) || !golden.open(goldenFileName)) {
+    fprintf(stderr, "could not read %s or %s\n", traceFileName, goldenFileName);
+    return false;
+  }
+
+  TraceSummary traceSummary, goldenSummary;
+  StepEvent a, b;
+  bool moreA = trace.next(a);
+  bool moreB = golden.next(b);
+  bool orderDiffers = false;
+  bool timingDiffers = false;
+  while (moreA || moreB) {
+    if (moreA && moreB) {
+      if (!orderDiffers && (a.motor != b.motor || a.dir != b.dir)) {
+        printf("First step divergence at step %lu:\n", traceSummary.events);
+        printEvent("golden", b);
+        printEvent("trace ", a);
+        orderDiffers = true;
+      } else if (!orderDiffers && !timingDiffers && a.time != b.time) {
+        printf("First timing divergence at step %lu (same motor and direction):\n", traceSummary.events);
+        printEvent("golden", b);
+        printEvent("trace ", a);
+        timingDiffers = true;
+      }
+    } else if (!orderDiffers) {
+      printf("First step divergence at step %lu: %s has no more steps\n",
+             traceSummary.events, moreA ? "golden" : "trace");
+      orderDiffers = true;
+    }
+    if (moreA) {
+      count(traceSummary, a);
+      moreA = trace.next(a);
+    }
+    if (moreB) {
+      count(goldenSummary, b);
+      moreB = golden.next(b);
+    }
+  }
+
+  printSummary("golden", goldenSummary);
+  printSummary("trace ", traceSummary);
+  long delta = (long)traceSummary.endTime - (long)goldenSummary.endTime;
+  printf("print time change: %+.3f s (%+.2f%%)\n", delta / 1e6,
+         goldenSummary.endTime ? 100.0 * delta / goldenSummary.endTime : 0.0);
+
+  if (!orderDiffers && !timingDiffers) printf("traces identical\n");
+  else if (!orderDiffers) printf("same steps, different timing\n");
+  return !orderDiffers && !timingDiffers;
+}
+
+int main(int argc, char** argv) {
+  if (argc != 3 && argc != 4) {
+    fprintf(stderr, "usage: %s <file.gco> <out.trace> [golden.trace]\n", argv[0]);
+    return 2;
+  }
+
+  String gcoFileName = argv[1];
+  String txtFileName, idxFileName;
+  cacheFileNames(gcoFileName, txtFileName, idxFileName);
+  if (!fileManager.createTxtFile(gcoFileName.c_str(), txtFileName.c_str(), idxFileName.c_str())) {
+    return 2;
+  }
+
+  traceOut = fopen(argv[2], "wb");
+  if (!traceOut) {
+    fprintf(stderr, "could not create %s\n", argv[2]);
+    return 2;
+  }
+  fwrite(traceMagic, 1, 4, traceOut);
+  fputc(traceVersion, traceOut);
+  fputc(motorCount, traceOut);
+
+  // the planner starts with the same state as after reset, before any step is recorded
+  motionPlanner.begin();
+  timerHook = stepTimer;
+  stepHook = recordStep;
+  directionHook = recordDirection;
+
+  File target = SD.open(txtFileName.c_str(), FILE_READ);
+  if (!target) {
+    fprintf(stderr, "could not open %s\n", txtFileName.c_str());
+    return 2;
+  }
+  LayerIndex layerIndex;
+  layerIndex.open(idxFileName.c_str());
+  fileManager.getExecutor().excecuteTargetFile(target, layerIndex, 0);
+  layerIndex.close();
+
+  stepHook = nullptr;
+  directionHook = nullptr;
+  timerHook = nullptr;
+  fclose(traceOut);
+
+  if (argc == 3) {
+    TraceReader trace;
+    TraceSummary summary;
+    StepEvent event;
+    if (!trace.open(argv[2])) return 2;
+    while (trace.next(event)) count(summary, event);
+    printSummary(argv[2], summary);
+    return 0;
+  }
+  return compareTraces(argv[2], argv[3]) ? 0 : 1;
+}